@@ -11,6 +11,20 @@ BDROID_DIR := $(TOP_DIR)external/bluetooth/bluedroid
 LOCAL_SRC_FILES := \
         src/bt_vendor_mrvl.c \
         src/hardware_mrvl.c \
+        src/conf_mrvl.c \
+        src/userial_mrvl.c \
+        src/fw_loader_mrvl.c \
+        src/transport_mrvl.c \
+        src/hci_cfg_mrvl.c \
+        src/adv_filter_mrvl.c \
+        src/pm_qos_mrvl.c \
+        src/journal_mrvl.c \
+        src/fd_handoff_mrvl.c \
+        src/vendor_evt_mrvl.c \
+        src/dump_mrvl.c \
+        src/tx_power_mrvl.c \
+        src/fw_dump_mrvl.c \
+        src/ll_link_mrvl.c \
 
 LOCAL_C_INCLUDES += \
         $(LOCAL_PATH)/include \
@@ -18,22 +32,104 @@ LOCAL_C_INCLUDES += \
         hardware/marvell/wlan/mrvl/MarvellWireless
 
 LOCAL_SHARED_LIBRARIES := \
-        libcutils
+        libcutils \
+        libz
 
 ifneq ($(MRVL_WIRELESS_DAEMON_API),)
 LOCAL_CFLAGS += -DMRVL_WIRELESS_DAEMON_API
 LOCAL_SHARED_LIBRARIES += libMarvellWireless
 endif
 
+# Vendor command setting the controller TX power, one signed dBm byte.
+# Firmware dependent, so there is no default; without it TxPowerPolicy
+# is ignored.
+ifneq ($(MRVL_TX_POWER_OPCODE),)
+LOCAL_CFLAGS += -DHCI_CMD_MARVELL_SET_TX_POWER=$(MRVL_TX_POWER_OPCODE)
+endif
+
+# Relay throughput/CPU counters, off in shipping builds
+ifeq ($(MRVL_RELAY_STATS),true)
+LOCAL_CFLAGS += -DMRVL_RELAY_STATS
+endif
+
 LOCAL_MODULE := libbt-vendor
 LOCAL_MODULE_TAGS := optional
 LOCAL_MODULE_CLASS := SHARED_LIBRARIES
 LOCAL_MODULE_OWNER := marvell
 LOCAL_MODULE_PATH := $(TARGET_OUT_VENDOR_SHARED_LIBRARIES)
 
+# Board profile baked into ready vendor command images, see
+# tools/gen_board_cmds.py; generic builds configure at run time
+ifneq ($(MRVL_BOARD_PROFILE),)
+mrvl_gen_dir := $(call local-generated-sources-dir)
+mrvl_board_cmds := $(mrvl_gen_dir)/mrvl_board_cmds.h
+$(mrvl_board_cmds): PRIVATE_TOOL := $(LOCAL_PATH)/tools/gen_board_cmds.py
+$(mrvl_board_cmds): PRIVATE_CUSTOM_TOOL = python $(PRIVATE_TOOL) $< $@
+$(mrvl_board_cmds): $(MRVL_BOARD_PROFILE) $(LOCAL_PATH)/tools/gen_board_cmds.py
+	$(transform-generated-source)
+LOCAL_GENERATED_SOURCES += $(mrvl_board_cmds)
+LOCAL_C_INCLUDES += $(mrvl_gen_dir)
+LOCAL_CFLAGS += -DMRVL_BOARD_PROFILE
+endif
+
 
 include $(BUILD_SHARED_LIBRARY)
 
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := tools/mrvl_enable_dump.c
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/include
+LOCAL_MODULE := mrvl_enable_dump
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := tools/mrvl_bt_fdkeeper.c
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/include
+LOCAL_SHARED_LIBRARIES := libcutils liblog
+LOCAL_MODULE := mrvl_bt_fdkeeper
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+# Relay benchmark against an emulated controller, host only. Links the
+# whole lib, which the sco and nodes modes drive through its vendor
+# interface.
+LOCAL_SRC_FILES := \
+        tools/mrvl_relay_bench.c \
+        src/bt_vendor_mrvl.c \
+        src/hardware_mrvl.c \
+        src/conf_mrvl.c \
+        src/userial_mrvl.c \
+        src/fw_loader_mrvl.c \
+        src/transport_mrvl.c \
+        src/hci_cfg_mrvl.c \
+        src/adv_filter_mrvl.c \
+        src/pm_qos_mrvl.c \
+        src/journal_mrvl.c \
+        src/fd_handoff_mrvl.c \
+        src/vendor_evt_mrvl.c \
+        src/dump_mrvl.c \
+        src/tx_power_mrvl.c \
+        src/fw_dump_mrvl.c \
+        src/ll_link_mrvl.c \
+
+LOCAL_C_INCLUDES += \
+        $(LOCAL_PATH)/include \
+        $(BDROID_DIR)/hci/include \
+        hardware/marvell/wlan/mrvl/MarvellWireless
+LOCAL_CFLAGS += -DMRVL_RELAY_STATS
+LOCAL_STATIC_LIBRARIES := libcutils liblog
+LOCAL_LDLIBS := -lpthread -lrt -lz
+LOCAL_MODULE := mrvl_relay_bench
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_EXECUTABLE)
+
 
 
 endif # BOARD_HAVE_BLUETOOTH_MRVL
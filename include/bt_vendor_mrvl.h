@@ -38,11 +38,287 @@
 #define BLUETOOTH_VENDOR_PORT      "/dev/mbtchar0"   
 #endif
 
+/* Device port name where a UART attached controller lives */
+#ifndef BLUETOOTH_UART_PORT
+#define BLUETOOTH_UART_PORT        "/dev/ttyS1"
+#endif
+
+/* Baud rate the UART controller boots with */
+#ifndef BLUETOOTH_UART_BAUD
+#define BLUETOOTH_UART_BAUD        115200
+#endif
+
+/* mbtchar node poll while the driver brings the firmware up */
+#define MRVL_OPEN_POLL_MS          200
+
+/* Transport used to reach the controller */
+#define MRVL_TRANSPORT_SDIO        0
+#define MRVL_TRANSPORT_UART        1
+
+/* SCO data path, payload of HCI_CMD_MARVELL_SET_SCO_DATA_PATH */
+#define MRVL_SCO_PATH_HCI          0x00
+#define MRVL_SCO_PATH_PCM          0x01
+
+/* H4 packet types */
+#define H4_TYPE_CMD                0x01
+#define H4_TYPE_ACL                0x02
+#define H4_TYPE_SCO                0x03
+#define H4_TYPE_EVT                0x04
+
+/* Packet direction as seen from the host */
+#define MRVL_DIR_RX                0
+#define MRVL_DIR_TX                1
+#define MRVL_DIR_MAX               2
+
+/* Holders of the CPU latency request */
+#define PM_QOS_ENABLE              0x01
+#define PM_QOS_SCO_CFG             0x02
+#define PM_QOS_SCO_LINK            0x04
+
+/* Largest parameter block of a command built by hci_cfg_mrvl.c */
+#define HCI_CFG_MAX_PARAM          4
+
+/* Maximum length of a string value in the configuration file */
+#define MRVL_CONF_STR_LEN          64
+
+/* TX power policy */
+#define MRVL_TX_POWER_OFF          0
+#define MRVL_TX_POWER_FIXED        1
+#define MRVL_TX_POWER_ADAPTIVE     2
+
+/*
+ * Marvell operations for bt_vnd_mrvl_if_op, numbered past the standard
+ * bt_vendor_opcode_t range. They are issued through the op() entry of
+ * BLUETOOTH_VENDOR_LIB_INTERFACE from the stack's context, like the
+ * standard ones, since they may send commands through xmit_cb.
+ */
+#define BT_VND_OP_MRVL_BASE            0x1000
+/* param: const char *, name of the PCM profile to switch to */
+#define BT_VND_OP_MRVL_SET_PCM_PROFILE (BT_VND_OP_MRVL_BASE + 0)
+/* param: const char *, name of the link profile to switch to */
+#define BT_VND_OP_MRVL_SET_LINK_PROFILE (BT_VND_OP_MRVL_BASE + 1)
+/* param: const struct mrvl_low_latency_param *, the ACL link to change */
+#define BT_VND_OP_MRVL_SET_LOW_LATENCY (BT_VND_OP_MRVL_BASE + 2)
+
+/* Vendor lib steps reported by the state dump */
+#define MRVL_STEP_OFF              0
+#define MRVL_STEP_POWER_ON         1
+#define MRVL_STEP_OPEN             2
+#define MRVL_STEP_FW_CFG           3
+#define MRVL_STEP_SCO_CFG          4
+#define MRVL_STEP_PCM_UPDATE       5
+#define MRVL_STEP_LINK_PROFILE     6
+#define MRVL_STEP_ON               7
+#define MRVL_STEP_MAX              8
+
+/* LogLevel values; below debug, ALOGD is dropped at run time */
+#define MRVL_LOG_INFO              0
+#define MRVL_LOG_DEBUG             1
+
+/******************************************************************************
+**  Type definitions
+******************************************************************************/
+
+/* Run-time configuration, defaults overridden by VENDOR_LIB_CONF_FILE */
+struct mrvl_vnd_conf {
+	int transport;
+	char mchar_port[MRVL_CONF_STR_LEN];
+	char uart_port[MRVL_CONF_STR_LEN];
+	uint32_t uart_baud;
+	int uart_flow_ctl;
+	uint32_t uart_oper_baud;
+	uint32_t uart_verify_ms;
+	char uart_fw_file[MRVL_CONF_STR_LEN];
+	char uart_helper_file[MRVL_CONF_STR_LEN];
+	uint32_t uart_fw_baud;
+	uint32_t uart_fw_timeout_ms;
+	uint32_t sco_data_path;
+	char pcm_profile[MRVL_CONF_STR_LEN];
+	uint32_t le_max_tx_octets;
+	uint32_t le_max_tx_time;
+	uint32_t le_default_phy;
+	char link_profile[MRVL_CONF_STR_LEN];
+	int transport_relay;
+	uint32_t le_adv_dedup_ms;
+	uint32_t cpu_latency_us;
+	char journal_file[MRVL_CONF_STR_LEN];  /* empty: no journal */
+	int fd_handoff;
+	int ready_probe;
+	uint32_t ready_probe_timeout_ms;
+	uint32_t ready_probe_budget_ms;
+	int vendor_evt_tap;
+	uint32_t vendor_fault_evt;
+	int conf_hot_reload;
+	uint32_t dump_signal;
+	uint32_t tx_power_policy;
+	int tx_power_dbm;
+	int tx_power_min_dbm;
+	int tx_power_max_dbm;
+	int tx_power_rssi_low;
+	int tx_power_rssi_high;
+	uint32_t tx_power_step_db;
+	uint32_t tx_power_min_interval_ms;
+	char fw_dump_file[MRVL_CONF_STR_LEN];
+	char fw_dump_trigger[MRVL_CONF_STR_LEN];
+	char fw_dump_source[MRVL_CONF_STR_LEN];
+	char fw_dump_device[MRVL_CONF_STR_LEN];
+	uint32_t fw_dump_budget_ms;
+	int ll_links;
+	uint32_t ll_poll_us;
+};
+
+/*
+ * Tunables that may change while Bluetooth is on. A snapshot is never
+ * modified once published; a reload publishes a new one.
+ */
+struct mrvl_rt_conf {
+	uint32_t lpm_idle_timeout_ms;
+	uint32_t log_level;
+	uint32_t open_deadline_ms;
+	uint32_t power_on_tries;
+	uint32_t power_on_backoff_ms;
+	int relay_nice;
+};
+
+
+/* Parameter of BT_VND_OP_MRVL_SET_LOW_LATENCY */
+struct mrvl_low_latency_param {
+	uint16_t handle;           /* ACL connection handle */
+	uint8_t enable;            /* TRUE: poll it every LowLatencyPollUs */
+};
+
+/* Timing of the last enable, power on to end of FW config */
+struct mrvl_enable_stats {
+	uint32_t power_ms;
+	uint32_t open_ms;
+	uint32_t open_retries;
+	uint32_t fwcfg_ms;
+	uint32_t total_ms;
+	uint32_t cpu_ms;
+	uint32_t cmd_failures;
+	uint32_t probe_attempts;
+	uint32_t probe_ms;
+	int result;
+};
 
 /******************************************************************************
 **  Extern variables and functions
 ******************************************************************************/
 
 extern bt_vendor_callbacks_t *bt_vendor_cbacks;
+extern struct mrvl_vnd_conf vnd_conf;
+extern struct mrvl_enable_stats vnd_enable_stats;
+extern const struct mrvl_rt_conf *vnd_rt_conf;
+
+/* Current tunables snapshot; lock free, valid for the caller's use */
+static inline const struct mrvl_rt_conf *vnd_rt_conf_get(void)
+{
+	return __atomic_load_n(&vnd_rt_conf, __ATOMIC_ACQUIRE);
+}
+
+#ifdef ALOGD
+#undef ALOGD
+#define ALOGD(...) do { \
+		if (vnd_rt_conf_get()->log_level >= MRVL_LOG_DEBUG) \
+			((void)ALOG(LOG_DEBUG, LOG_TAG, __VA_ARGS__)); \
+	} while (0)
+#endif
+
+/* hardware_mrvl.c */
+int hw_mrvl_set_pcm_profile(const char *name);
+const char *hw_mrvl_pcm_profile_name(unsigned int idx);
+int hw_mrvl_set_link_profile(const char *name);
+void hw_mrvl_controller_fault(uint8_t code);
+void hw_mrvl_dump_state(void);
+int hw_mrvl_set_low_latency(uint16_t handle, int enable);
+
+/* conf_mrvl.c */
+void vnd_load_conf(const char *p_path);
+void vnd_conf_watch_start(const char *p_path);
+void vnd_conf_watch_stop(void);
+
+/* userial_mrvl.c */
+int userial_mrvl_open_uart(const char *port, uint32_t baud, int flow_ctl);
+int userial_mrvl_set_baud(int fd, uint32_t baud);
+int userial_mrvl_ping(int fd, uint32_t timeout_ms);
+int userial_mrvl_probe(int fd, uint32_t timeout_ms, uint32_t budget_ms,
+		uint32_t *p_attempts, uint32_t *p_latency_ms);
+
+/* fw_loader_mrvl.c */
+int fw_loader_mrvl_download(int fd);
+
+/* hci_cfg_mrvl.c */
+int hci_cfg_mrvl_needed(void);
+int hci_cfg_mrvl_set_link_profile(const char *name);
+int hci_cfg_mrvl_link_cmd(int idx, uint16_t *p_opcode, uint8_t *p_param);
+int hci_cfg_mrvl_post_reset(uint16_t done, uint8_t status,
+		const uint8_t *p_ret, int ret_len, uint8_t *p_cmd);
+
+/* adv_filter_mrvl.c */
+void adv_filter_mrvl_reset(void);
+int adv_filter_mrvl_drop(const uint8_t *p, int len, uint64_t ts);
+void adv_filter_mrvl_dump_stats(void);
+
+/* fd_handoff_mrvl.c */
+int fd_handoff_mrvl_get(void);
+void fd_handoff_mrvl_put(int fd);
+void fd_handoff_mrvl_healthy(void);
+void fd_handoff_mrvl_drop(void);
+
+/* journal_mrvl.c */
+void journal_mrvl_record(const struct mrvl_enable_stats *st);
+void journal_mrvl_stop(void);
+
+/* pm_qos_mrvl.c */
+void pm_qos_mrvl_acquire(int who);
+void pm_qos_mrvl_release(int who);
+
+/* dump_mrvl.c */
+void dump_mrvl_step(int step);
+void dump_mrvl_cmd_sent(uint16_t cmd);
+void dump_mrvl_cmd_done(uint16_t cmd, uint8_t status);
+void dump_mrvl_start(int signo);
+void dump_mrvl_stop(void);
+
+/* ll_link_mrvl.c */
+int ll_link_mrvl_add(uint16_t handle, uint16_t saved_policy);
+int ll_link_mrvl_policy(uint16_t handle);
+int ll_link_mrvl_remove(uint16_t handle, const char *why);
+void ll_link_mrvl_acl_rx(uint16_t handle, uint64_t ts);
+void ll_link_mrvl_link_down(uint16_t handle);
+void ll_link_mrvl_reset(void);
+
+/* fw_dump_mrvl.c */
+void fw_dump_mrvl_start(uint8_t code);
+void fw_dump_mrvl_wait(void);
+void fw_dump_mrvl_dump_stats(void);
+
+/* tx_power_mrvl.c */
+int tx_power_mrvl_needed(void);
+void tx_power_mrvl_reset(void);
+int tx_power_mrvl_initial(int8_t *p_dbm);
+void tx_power_mrvl_applied(int8_t dbm, int ok);
+void tx_power_mrvl_rssi(uint16_t handle, int8_t rssi);
+void tx_power_mrvl_link_down(uint16_t handle);
+void tx_power_mrvl_le_link_up(uint16_t handle);
+void tx_power_mrvl_dump_stats(void);
+
+/* vendor_evt_mrvl.c */
+void vendor_evt_mrvl_reset(void);
+void vendor_evt_mrvl_tap(const uint8_t *p, int len);
+void vendor_evt_mrvl_host_wake(int asserted);
+void vendor_evt_mrvl_dump_stats(void);
+
+/* transport_mrvl.c */
+/* Answer to a command the lib sent through the relay, 0xFF for none */
+typedef void (*transport_mrvl_cmd_cb)(uint16_t opcode, uint8_t status);
+
+int transport_mrvl_needed(void);
+int transport_mrvl_start(int port_fd);
+void transport_mrvl_stop(void);
+int transport_mrvl_send_cmd(uint16_t opcode, const uint8_t *p_param,
+		int param_len, transport_mrvl_cmd_cb p_cb);
+void transport_mrvl_dump_stats(void);
+
 #endif /* BT_VENDOR_MRVL_H */
 
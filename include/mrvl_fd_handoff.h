@@ -0,0 +1,49 @@
+/******************************************************************************
+ *
+ *  Copyright (C) 2012 Marvell International Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at:
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+/******************************************************************************
+ *
+ *  Filename:      mrvl_fd_handoff.h
+ *
+ *  Description:   Protocol between the vendor lib and mrvl_bt_fdkeeper,
+ *                 the helper that holds the controller port open across
+ *                 Bluetooth process restarts.
+ *
+ *  Every request is one connection carrying a single op byte; a port fd
+ *  travels as SCM_RIGHTS. GET is answered with one byte, FD_HEALTHY when
+ *  a configured controller's fd comes with it, FD_NONE otherwise.
+ *
+ ******************************************************************************/
+
+#ifndef MRVL_FD_HANDOFF_H
+#define MRVL_FD_HANDOFF_H
+
+/* Abstract namespace socket name */
+#ifndef MRVL_FD_KEEPER_SOCKET
+#define MRVL_FD_KEEPER_SOCKET "mrvl_bt_fdkeeper"
+#endif
+
+#define FD_OP_PUT      'P'   /* keep this fd, controller not configured */
+#define FD_OP_HEALTHY  'H'   /* FW config done on the kept fd */
+#define FD_OP_GET      'G'   /* hand the fd back if it is healthy */
+#define FD_OP_DROP     'D'   /* orderly shutdown, close the kept fd */
+
+#define FD_NONE        0
+#define FD_HEALTHY     1
+
+#endif /* MRVL_FD_HANDOFF_H */
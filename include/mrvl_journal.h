@@ -0,0 +1,83 @@
+/******************************************************************************
+ *
+ *  Copyright (C) 2012 Marvell International Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at:
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+/******************************************************************************
+ *
+ *  Filename:      mrvl_journal.h
+ *
+ *  Description:   On-disk layout of the enable timing journal, shared by
+ *                 the vendor lib and the dump tool.
+ *
+ *  The file is a ring of MRVL_JOURNAL_SLOTS fixed size records; record n
+ *  lives in slot n % MRVL_JOURNAL_SLOTS. A record torn by a crash fails
+ *  its CRC and is skipped by readers.
+ *
+ ******************************************************************************/
+
+#ifndef MRVL_JOURNAL_H
+#define MRVL_JOURNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Suggested JournalFile path, and where the dump tool looks by default */
+#ifndef MRVL_JOURNAL_FILE
+#define MRVL_JOURNAL_FILE "/data/misc/bluedroid/mrvl_enable.jnl"
+#endif
+
+#define MRVL_JOURNAL_MAGIC 0x4A56524D  /* "MRVJ" */
+#define MRVL_JOURNAL_SLOTS 32
+
+struct mrvl_journal_rec {
+	uint32_t magic;
+	uint32_t seq;
+	uint32_t time;           /* seconds since the epoch */
+	uint32_t power_ms;
+	uint32_t open_ms;
+	uint32_t open_retries;
+	uint32_t fwcfg_ms;
+	uint32_t total_ms;
+	uint32_t cpu_ms;
+	uint32_t cmd_failures;
+	int32_t result;          /* 0 success, else failure */
+	uint32_t crc;            /* CRC-32 of the fields above */
+};
+
+static inline uint32_t mrvl_journal_crc(const struct mrvl_journal_rec *rec)
+{
+	const uint8_t *p = (const uint8_t *) rec;
+	size_t len = offsetof(struct mrvl_journal_rec, crc);
+	uint32_t crc = 0xFFFFFFFF;
+	int bit;
+
+	while (len--) {
+		crc ^= *p++;
+		for (bit = 0; bit < 8; bit++)
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+	}
+
+	return ~crc;
+}
+
+static inline int mrvl_journal_valid(const struct mrvl_journal_rec *rec)
+{
+	return rec->magic == MRVL_JOURNAL_MAGIC &&
+		rec->crc == mrvl_journal_crc(rec);
+}
+
+#endif /* MRVL_JOURNAL_H */
@@ -0,0 +1,187 @@
+/******************************************************************************
+ *
+ *  Copyright (C) 2012 Marvell International Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at:
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+/******************************************************************************
+ *
+ *  Filename:      adv_filter_mrvl.c
+ *
+ *  Description:   Drops repeated LE advertising reports on their way to
+ *                 the stack. A report is a repeat if the same address sent
+ *                 the same payload within the configured window; the first
+ *                 one of each window still goes through.
+ *
+ ******************************************************************************/
+
+#define LOG_TAG "bt_mrvl"
+
+#include <utils/Log.h>
+#include <string.h>
+
+#include "bt_vendor_mrvl.h"
+
+#define HCI_EVT_LE_META              0x3E
+#define HCI_LE_ADV_REPORT            0x02
+#define HCI_LE_EXT_ADV_REPORT        0x0D
+
+/* Offsets in an H4 LE meta event carrying a single report */
+#define ADV_OFF_NUM                  4
+#define ADV_OFF_ADDR_TYPE            6
+#define ADV_OFF_ADDR                 7
+#define ADV_OFF_DATA_LEN             13
+#define EXT_ADV_OFF_ADDR_TYPE        7
+#define EXT_ADV_OFF_ADDR             8
+#define EXT_ADV_OFF_DATA_LEN         28
+
+/* Power of two; probes stop after ADV_MAX_PROBE slots */
+#define ADV_TABLE_SIZE               1024
+#define ADV_MAX_PROBE                8
+
+struct adv_entry {
+	uint64_t seen_ns;          /* 0 if the slot is free */
+	uint32_t hash;             /* payload hash */
+	uint8_t addr_type;
+	uint8_t addr[6];
+};
+
+/***********************************************************
+ *  Local variables
+ ***********************************************************
+ */
+static struct adv_entry adv_table[ADV_TABLE_SIZE];
+
+static uint32_t adv_seen;
+static uint32_t adv_dropped;
+static uint64_t adv_bytes_dropped;
+static uint32_t adv_evicted;
+
+/***********************************************************
+ *  Local functions
+ ***********************************************************
+ */
+static uint32_t fnv1a(uint32_t h, const uint8_t *p, int len)
+{
+	while (len--) {
+		h ^= *p++;
+		h *= 16777619U;
+	}
+
+	return h;
+}
+
+/***********************************************************
+ *  Global functions
+ ***********************************************************
+ */
+void adv_filter_mrvl_reset(void)
+{
+	memset(adv_table, 0, sizeof(adv_table));
+	adv_seen = adv_dropped = adv_evicted = 0;
+	adv_bytes_dropped = 0;
+}
+
+/*
+ * p is a complete H4 event. Returns TRUE if it is an advertising report
+ * already delivered within the window and should be dropped.
+ */
+int adv_filter_mrvl_drop(const uint8_t *p, int len, uint64_t ts)
+{
+	uint64_t window_ns = (uint64_t) vnd_conf.le_adv_dedup_ms * 1000000ULL;
+	const uint8_t *p_addr;
+	struct adv_entry *e, *victim = NULL;
+	uint32_t hash, slot;
+	uint8_t addr_type;
+	int data_off;
+	int data_len;
+	int i;
+
+	if (!window_ns || p[1] != HCI_EVT_LE_META || len <= ADV_OFF_NUM)
+		return FALSE;
+
+	/* Multi-report events are rare; leave them alone */
+	switch (p[3]) {
+	case HCI_LE_ADV_REPORT:
+		if (p[ADV_OFF_NUM] != 1 || len <= ADV_OFF_DATA_LEN)
+			return FALSE;
+		addr_type = p[ADV_OFF_ADDR_TYPE];
+		p_addr = p + ADV_OFF_ADDR;
+		data_off = ADV_OFF_DATA_LEN + 1;
+		data_len = p[ADV_OFF_DATA_LEN];
+		break;
+	case HCI_LE_EXT_ADV_REPORT:
+		if (p[ADV_OFF_NUM] != 1 || len <= EXT_ADV_OFF_DATA_LEN)
+			return FALSE;
+		addr_type = p[EXT_ADV_OFF_ADDR_TYPE];
+		p_addr = p + EXT_ADV_OFF_ADDR;
+		data_off = EXT_ADV_OFF_DATA_LEN + 1;
+		data_len = p[EXT_ADV_OFF_DATA_LEN];
+		break;
+	default:
+		return FALSE;
+	}
+
+	if (data_off + data_len > len)
+		return FALSE;
+
+	adv_seen++;
+
+	/* RSSI is left out, it changes on every report */
+	hash = fnv1a(2166136261U, p + ADV_OFF_NUM + 1, 1);
+	hash = fnv1a(hash, p + data_off, data_len);
+	slot = fnv1a(hash, p_addr, 6);
+
+	for (i = 0; i < ADV_MAX_PROBE; i++) {
+		e = &adv_table[(slot + i) & (ADV_TABLE_SIZE - 1)];
+
+		if (e->seen_ns && ts - e->seen_ns < window_ns) {
+			if (e->hash == hash && e->addr_type == addr_type &&
+					!memcmp(e->addr, p_addr, 6)) {
+				adv_dropped++;
+				adv_bytes_dropped += len;
+				return TRUE;
+			}
+			if (!victim || e->seen_ns < victim->seen_ns)
+				victim = e;
+			continue;
+		}
+
+		/* Free or expired slot */
+		victim = e;
+		break;
+	}
+
+	if (i == ADV_MAX_PROBE)
+		adv_evicted++;
+
+	victim->seen_ns = ts;
+	victim->hash = hash;
+	victim->addr_type = addr_type;
+	memcpy(victim->addr, p_addr, 6);
+
+	return FALSE;
+}
+
+void adv_filter_mrvl_dump_stats(void)
+{
+	if (!adv_seen)
+		return;
+
+	ALOGI("adv filter: %u reports, %u dropped (%u%%), %llu bytes "
+		"kept from the stack, %u evictions", adv_seen, adv_dropped,
+		adv_dropped * 100 / adv_seen,
+		(unsigned long long) adv_bytes_dropped, adv_evicted);
+}
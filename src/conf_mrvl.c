@@ -0,0 +1,695 @@
+/******************************************************************************
+ *
+ *  Copyright (C) 2012 Marvell International Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at:
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+/******************************************************************************
+ *
+ *  Filename:      conf_mrvl.c
+ *
+ *  Description:   Contains functions to parse the run-time configuration
+ *                 file (VENDOR_LIB_CONF_FILE)
+ *
+ ******************************************************************************/
+
+#define LOG_TAG "bt_mrvl"
+
+#include <utils/Log.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#include "bt_vendor_mrvl.h"
+
+#define CONF_COMMENT '#'
+#define CONF_DELIMITERS " =\n\r\t"
+#define CONF_MAX_LINE_LEN 255
+
+/* Tunable defaults, see struct mrvl_rt_conf */
+#define RT_LPM_IDLE_TIMEOUT_MS 3000
+#define RT_OPEN_DEADLINE_MS    4000
+#define RT_POWER_ON_TRIES      3
+#define RT_POWER_ON_BACKOFF_MS 50
+
+/* Accepted ranges; values outside are clamped with a warning */
+#define RT_OPEN_DEADLINE_MAX_MS    30000
+#define RT_POWER_ON_TRIES_MAX      10
+#define RT_POWER_ON_BACKOFF_MAX_MS 1000
+#define RT_NICE_MIN                (-20)
+#define RT_NICE_MAX                19
+
+/* LE Write Suggested Default Data Length limits from the spec */
+#define LE_TX_OCTETS_MIN           27
+#define LE_TX_OCTETS_MAX           251
+#define LE_TX_TIME_MIN             328
+#define LE_TX_TIME_MAX             17040
+#define LE_PHY_ALL                 0x07
+
+typedef int (conf_action_t)(char *p_conf_name, char *p_conf_value, int param);
+
+typedef struct {
+	const char *conf_entry;
+	conf_action_t *p_action;
+	int param;
+} conf_entry_t;
+
+/***********************************************************
+ *  Global variables
+ ***********************************************************
+ */
+struct mrvl_vnd_conf vnd_conf;
+
+static const struct mrvl_rt_conf rt_conf_default = {
+	.lpm_idle_timeout_ms = RT_LPM_IDLE_TIMEOUT_MS,
+	.log_level = MRVL_LOG_DEBUG,
+	.open_deadline_ms = RT_OPEN_DEADLINE_MS,
+	.power_on_tries = RT_POWER_ON_TRIES,
+	.power_on_backoff_ms = RT_POWER_ON_BACKOFF_MS,
+	.relay_nice = 0,
+};
+
+const struct mrvl_rt_conf *vnd_rt_conf = &rt_conf_default;
+
+/***********************************************************
+ *  Local variables
+ ***********************************************************
+ */
+
+/* What vnd_conf holds before each load, keys missing from the file */
+static const struct mrvl_vnd_conf vnd_conf_default = {
+	.transport     = MRVL_TRANSPORT_SDIO,
+	.mchar_port    = BLUETOOTH_VENDOR_PORT,
+	.uart_port     = BLUETOOTH_UART_PORT,
+	.uart_baud     = BLUETOOTH_UART_BAUD,
+	.uart_flow_ctl = TRUE,
+	.uart_oper_baud = 0,
+	.uart_verify_ms = 500,
+	.uart_fw_timeout_ms = 1000,
+	.sco_data_path = MRVL_SCO_PATH_PCM,
+	.le_max_tx_time = 2120,
+	.ready_probe = TRUE,
+	.ready_probe_timeout_ms = 100,
+	.ready_probe_budget_ms = 2000,
+	.tx_power_dbm = 4,
+	.tx_power_min_dbm = -20,
+	.tx_power_max_dbm = 8,
+	.tx_power_rssi_low = -70,
+	.tx_power_rssi_high = -45,
+	.tx_power_step_db = 4,
+	.tx_power_min_interval_ms = 2000,
+	.fw_dump_budget_ms = 5000,
+	.ll_poll_us = 1250,
+};
+
+/* Structure the setters of the table being parsed write into */
+static char *conf_base;
+
+/*
+ * Published snapshots. Readers take no lock and may still hold an old
+ * one, so they are only freed once the watcher is gone; reloads are
+ * rare enough that this costs a few bytes per edit of the file.
+ */
+struct rt_conf_node {
+	struct mrvl_rt_conf conf;
+	struct rt_conf_node *next;
+};
+static struct rt_conf_node *rt_conf_list;
+
+static pthread_t watch_thread;
+static int watch_running;
+static int watch_fd = -1;
+static int watch_wake[2] = {-1, -1};
+static char watch_path[PATH_MAX];
+
+/***********************************************************
+ *  Local functions
+ ***********************************************************
+ */
+static int conf_set_str(char *p_conf_name, char *p_conf_value, int param)
+{
+	char *p_field = conf_base + param;
+
+	strlcpy(p_field, p_conf_value, MRVL_CONF_STR_LEN);
+	return 0;
+}
+
+static int conf_set_uint(char *p_conf_name, char *p_conf_value, int param)
+{
+	uint32_t *p_field = (uint32_t *) (conf_base + param);
+	char *p_end = NULL;
+	unsigned long val;
+
+	val = strtoul(p_conf_value, &p_end, 0);
+	if (p_end == p_conf_value || *p_end != '\0') {
+		ALOGW("conf: invalid number for %s: %s", p_conf_name,
+			p_conf_value);
+		return -1;
+	}
+
+	*p_field = (uint32_t) val;
+	return 0;
+}
+
+static int conf_set_bool(char *p_conf_name, char *p_conf_value, int param)
+{
+	int *p_field = (int *) (conf_base + param);
+
+	if (!strcasecmp(p_conf_value, "true") || !strcmp(p_conf_value, "1"))
+		*p_field = TRUE;
+	else if (!strcasecmp(p_conf_value, "false") ||
+			!strcmp(p_conf_value, "0"))
+		*p_field = FALSE;
+	else {
+		ALOGW("conf: invalid boolean for %s: %s", p_conf_name,
+			p_conf_value);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int conf_set_int(char *p_conf_name, char *p_conf_value, int param)
+{
+	int *p_field = (int *) (conf_base + param);
+	char *p_end = NULL;
+	long val;
+
+	val = strtol(p_conf_value, &p_end, 0);
+	if (p_end == p_conf_value || *p_end != '\0') {
+		ALOGW("conf: invalid number for %s: %s", p_conf_name,
+			p_conf_value);
+		return -1;
+	}
+
+	*p_field = (int) val;
+	return 0;
+}
+
+static int conf_set_log_level(char *p_conf_name, char *p_conf_value,
+		int param)
+{
+	uint32_t *p_field = (uint32_t *) (conf_base + param);
+
+	if (!strcasecmp(p_conf_value, "info"))
+		*p_field = MRVL_LOG_INFO;
+	else if (!strcasecmp(p_conf_value, "debug"))
+		*p_field = MRVL_LOG_DEBUG;
+	else {
+		ALOGW("conf: unknown log level %s", p_conf_value);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int conf_set_transport(char *p_conf_name, char *p_conf_value,
+		int param)
+{
+	if (!strcasecmp(p_conf_value, "sdio"))
+		vnd_conf.transport = MRVL_TRANSPORT_SDIO;
+	else if (!strcasecmp(p_conf_value, "uart"))
+		vnd_conf.transport = MRVL_TRANSPORT_UART;
+	else {
+		ALOGW("conf: unknown transport %s", p_conf_value);
+		return -1;
+	}
+
+	return 0;
+}
+
+#ifndef MRVL_BOARD_PROFILE
+static int conf_set_sco_path(char *p_conf_name, char *p_conf_value,
+		int param)
+{
+	if (!strcasecmp(p_conf_value, "pcm"))
+		vnd_conf.sco_data_path = MRVL_SCO_PATH_PCM;
+	else if (!strcasecmp(p_conf_value, "hci"))
+		vnd_conf.sco_data_path = MRVL_SCO_PATH_HCI;
+	else {
+		ALOGW("conf: unknown SCO data path %s", p_conf_value);
+		return -1;
+	}
+
+	return 0;
+}
+#endif
+
+static int conf_set_tx_power(char *p_conf_name, char *p_conf_value,
+		int param)
+{
+	if (!strcasecmp(p_conf_value, "off"))
+		vnd_conf.tx_power_policy = MRVL_TX_POWER_OFF;
+	else if (!strcasecmp(p_conf_value, "fixed"))
+		vnd_conf.tx_power_policy = MRVL_TX_POWER_FIXED;
+	else if (!strcasecmp(p_conf_value, "adaptive"))
+		vnd_conf.tx_power_policy = MRVL_TX_POWER_ADAPTIVE;
+	else {
+		ALOGW("conf: unknown TX power policy %s", p_conf_value);
+		return -1;
+	}
+
+#ifndef HCI_CMD_MARVELL_SET_TX_POWER
+	if (vnd_conf.tx_power_policy != MRVL_TX_POWER_OFF) {
+		ALOGW("conf: no TX power command on this board, %s ignored",
+			p_conf_name);
+		vnd_conf.tx_power_policy = MRVL_TX_POWER_OFF;
+	}
+#endif
+
+	return 0;
+}
+
+/*
+ * Current supported entries and corresponding action functions
+ */
+static const conf_entry_t conf_table[] = {
+	{"Transport",       conf_set_transport, 0},
+	{"MbtcharPort",     conf_set_str,
+		offsetof(struct mrvl_vnd_conf, mchar_port)},
+	{"UartPort",        conf_set_str,
+		offsetof(struct mrvl_vnd_conf, uart_port)},
+	{"UartBaudRate",    conf_set_uint,
+		offsetof(struct mrvl_vnd_conf, uart_baud)},
+	{"UartFlowControl", conf_set_bool,
+		offsetof(struct mrvl_vnd_conf, uart_flow_ctl)},
+	{"UartOperBaudRate", conf_set_uint,
+		offsetof(struct mrvl_vnd_conf, uart_oper_baud)},
+	{"UartBaudVerifyMs", conf_set_uint,
+		offsetof(struct mrvl_vnd_conf, uart_verify_ms)},
+	{"UartFwFile",      conf_set_str,
+		offsetof(struct mrvl_vnd_conf, uart_fw_file)},
+	{"UartHelperFile",  conf_set_str,
+		offsetof(struct mrvl_vnd_conf, uart_helper_file)},
+	{"UartFwBaudRate",  conf_set_uint,
+		offsetof(struct mrvl_vnd_conf, uart_fw_baud)},
+	{"UartFwTimeoutMs", conf_set_uint,
+		offsetof(struct mrvl_vnd_conf, uart_fw_timeout_ms)},
+#ifndef MRVL_BOARD_PROFILE
+	/* Baked into the command images on board profile builds */
+	{"ScoDataPath",     conf_set_sco_path, 0},
+	{"PcmProfile",      conf_set_str,
+		offsetof(struct mrvl_vnd_conf, pcm_profile)},
+#endif
+	{"LeMaxTxOctets",   conf_set_uint,
+		offsetof(struct mrvl_vnd_conf, le_max_tx_octets)},
+	{"LeMaxTxTime",     conf_set_uint,
+		offsetof(struct mrvl_vnd_conf, le_max_tx_time)},
+	{"LeDefaultPhy",    conf_set_uint,
+		offsetof(struct mrvl_vnd_conf, le_default_phy)},
+	{"LinkProfile",     conf_set_str,
+		offsetof(struct mrvl_vnd_conf, link_profile)},
+	{"TransportRelay",  conf_set_bool,
+		offsetof(struct mrvl_vnd_conf, transport_relay)},
+	{"LeAdvDedupWindowMs", conf_set_uint,
+		offsetof(struct mrvl_vnd_conf, le_adv_dedup_ms)},
+	{"CpuLatencyUs",    conf_set_uint,
+		offsetof(struct mrvl_vnd_conf, cpu_latency_us)},
+	{"JournalFile",     conf_set_str,
+		offsetof(struct mrvl_vnd_conf, journal_file)},
+	{"FdHandoff",       conf_set_bool,
+		offsetof(struct mrvl_vnd_conf, fd_handoff)},
+	{"ReadyProbe",      conf_set_bool,
+		offsetof(struct mrvl_vnd_conf, ready_probe)},
+	{"ReadyProbeTimeoutMs", conf_set_uint,
+		offsetof(struct mrvl_vnd_conf, ready_probe_timeout_ms)},
+	{"ReadyProbeBudgetMs", conf_set_uint,
+		offsetof(struct mrvl_vnd_conf, ready_probe_budget_ms)},
+	{"VendorEventTap",  conf_set_bool,
+		offsetof(struct mrvl_vnd_conf, vendor_evt_tap)},
+	{"VendorFaultEvent", conf_set_uint,
+		offsetof(struct mrvl_vnd_conf, vendor_fault_evt)},
+	{"ConfHotReload",   conf_set_bool,
+		offsetof(struct mrvl_vnd_conf, conf_hot_reload)},
+	{"DumpSignal",      conf_set_uint,
+		offsetof(struct mrvl_vnd_conf, dump_signal)},
+	{"TxPowerPolicy",   conf_set_tx_power, 0},
+	{"TxPowerDbm",      conf_set_int,
+		offsetof(struct mrvl_vnd_conf, tx_power_dbm)},
+	{"TxPowerMinDbm",   conf_set_int,
+		offsetof(struct mrvl_vnd_conf, tx_power_min_dbm)},
+	{"TxPowerMaxDbm",   conf_set_int,
+		offsetof(struct mrvl_vnd_conf, tx_power_max_dbm)},
+	{"TxPowerRssiLow",  conf_set_int,
+		offsetof(struct mrvl_vnd_conf, tx_power_rssi_low)},
+	{"TxPowerRssiHigh", conf_set_int,
+		offsetof(struct mrvl_vnd_conf, tx_power_rssi_high)},
+	{"TxPowerStepDb",   conf_set_uint,
+		offsetof(struct mrvl_vnd_conf, tx_power_step_db)},
+	{"TxPowerMinIntervalMs", conf_set_uint,
+		offsetof(struct mrvl_vnd_conf, tx_power_min_interval_ms)},
+	{"FwDumpFile",      conf_set_str,
+		offsetof(struct mrvl_vnd_conf, fw_dump_file)},
+	{"FwDumpTrigger",   conf_set_str,
+		offsetof(struct mrvl_vnd_conf, fw_dump_trigger)},
+	{"FwDumpSource",    conf_set_str,
+		offsetof(struct mrvl_vnd_conf, fw_dump_source)},
+	{"FwDumpDevice",    conf_set_str,
+		offsetof(struct mrvl_vnd_conf, fw_dump_device)},
+	{"FwDumpBudgetMs",  conf_set_uint,
+		offsetof(struct mrvl_vnd_conf, fw_dump_budget_ms)},
+	{"LowLatencyLinks", conf_set_bool,
+		offsetof(struct mrvl_vnd_conf, ll_links)},
+	{"LowLatencyPollUs", conf_set_uint,
+		offsetof(struct mrvl_vnd_conf, ll_poll_us)},
+	{(const char *) NULL, NULL, 0}
+};
+
+/*
+ * Entries that are safe to change while Bluetooth is on. They fill a
+ * struct mrvl_rt_conf and are the only ones a reload looks at.
+ */
+static const conf_entry_t rt_conf_table[] = {
+	{"LpmIdleTimeoutMs", conf_set_uint,
+		offsetof(struct mrvl_rt_conf, lpm_idle_timeout_ms)},
+	{"LogLevel",        conf_set_log_level,
+		offsetof(struct mrvl_rt_conf, log_level)},
+	{"OpenDeadlineMs",  conf_set_uint,
+		offsetof(struct mrvl_rt_conf, open_deadline_ms)},
+	{"PowerOnTries",    conf_set_uint,
+		offsetof(struct mrvl_rt_conf, power_on_tries)},
+	{"PowerOnBackoffMs", conf_set_uint,
+		offsetof(struct mrvl_rt_conf, power_on_backoff_ms)},
+	{"RelayThreadNice", conf_set_int,
+		offsetof(struct mrvl_rt_conf, relay_nice)},
+	{(const char *) NULL, NULL, 0}
+};
+
+static uint32_t conf_clamp_uint(const char *p_name, uint32_t val,
+		uint32_t min, uint32_t max)
+{
+	if (val >= min && val <= max)
+		return val;
+
+	ALOGW("conf: %s %u out of range %u..%u, using %u", p_name, val,
+		min, max, val < min ? min : max);
+	return val < min ? min : max;
+}
+
+static int conf_clamp_int(const char *p_name, int val, int min, int max)
+{
+	if (val >= min && val <= max)
+		return val;
+
+	ALOGW("conf: %s %d out of range %d..%d, using %d", p_name, val,
+		min, max, val < min ? min : max);
+	return val < min ? min : max;
+}
+
+/*
+ * Bring values the lib cannot work with back into range: no power on
+ * attempt at all, an open deadline shorter than one poll, and so on.
+ */
+static void conf_check(struct mrvl_rt_conf *p_rt, int reload)
+{
+	p_rt->open_deadline_ms = conf_clamp_uint("OpenDeadlineMs",
+		p_rt->open_deadline_ms, MRVL_OPEN_POLL_MS,
+		RT_OPEN_DEADLINE_MAX_MS);
+	p_rt->power_on_tries = conf_clamp_uint("PowerOnTries",
+		p_rt->power_on_tries, 1, RT_POWER_ON_TRIES_MAX);
+	p_rt->power_on_backoff_ms = conf_clamp_uint("PowerOnBackoffMs",
+		p_rt->power_on_backoff_ms, 0, RT_POWER_ON_BACKOFF_MAX_MS);
+	p_rt->relay_nice = conf_clamp_int("RelayThreadNice",
+		p_rt->relay_nice, RT_NICE_MIN, RT_NICE_MAX);
+
+	if (reload)
+		return;
+
+	if (vnd_conf.le_max_tx_octets)
+		vnd_conf.le_max_tx_octets = conf_clamp_uint("LeMaxTxOctets",
+			vnd_conf.le_max_tx_octets, LE_TX_OCTETS_MIN,
+			LE_TX_OCTETS_MAX);
+	vnd_conf.le_max_tx_time = conf_clamp_uint("LeMaxTxTime",
+		vnd_conf.le_max_tx_time, LE_TX_TIME_MIN, LE_TX_TIME_MAX);
+	vnd_conf.le_default_phy = conf_clamp_uint("LeDefaultPhy",
+		vnd_conf.le_default_phy, 0, LE_PHY_ALL);
+	if (!vnd_conf.ready_probe_timeout_ms) {
+		ALOGW("conf: ReadyProbeTimeoutMs 0, using %u",
+			vnd_conf_default.ready_probe_timeout_ms);
+		vnd_conf.ready_probe_timeout_ms =
+			vnd_conf_default.ready_probe_timeout_ms;
+	}
+	if (vnd_conf.tx_power_min_dbm > vnd_conf.tx_power_max_dbm) {
+		ALOGW("conf: TxPowerMinDbm %d above TxPowerMaxDbm %d, using "
+			"defaults", vnd_conf.tx_power_min_dbm,
+			vnd_conf.tx_power_max_dbm);
+		vnd_conf.tx_power_min_dbm = vnd_conf_default.tx_power_min_dbm;
+		vnd_conf.tx_power_max_dbm = vnd_conf_default.tx_power_max_dbm;
+	}
+}
+
+static const conf_entry_t *conf_find(const conf_entry_t *p_table,
+		const char *p_name)
+{
+	for (; p_table->conf_entry; p_table++)
+		if (!strcmp(p_table->conf_entry, p_name))
+			return p_table;
+
+	return NULL;
+}
+
+/* Parse p_path into p_rt, and into vnd_conf unless this is a reload */
+static int conf_parse(const char *p_path, struct mrvl_rt_conf *p_rt,
+		int reload)
+{
+	FILE *p_file;
+	char *p_name;
+	char *p_value;
+	char *p_save;
+	const conf_entry_t *p_entry;
+	char line[CONF_MAX_LINE_LEN + 1]; /* add 1 for \0 char */
+
+	p_file = fopen(p_path, "r");
+	if (!p_file) {
+		ALOGI("vnd_load_conf file >%s< not found", p_path);
+		return -1;
+	}
+
+	/* read line by line */
+	while (fgets(line, sizeof(line), p_file) != NULL) {
+		if (line[0] == CONF_COMMENT)
+			continue;
+
+		p_name = strtok_r(line, CONF_DELIMITERS, &p_save);
+		if (!p_name)
+			continue;
+
+		p_value = strtok_r(NULL, CONF_DELIMITERS, &p_save);
+		if (!p_value) {
+			ALOGW("vnd_load_conf: missing value for name: %s",
+				p_name);
+			continue;
+		}
+
+		p_entry = conf_find(rt_conf_table, p_name);
+		if (p_entry) {
+			conf_base = (char *) p_rt;
+			p_entry->p_action(p_name, p_value, p_entry->param);
+			continue;
+		}
+
+		p_entry = conf_find(conf_table, p_name);
+		if (!p_entry)
+			ALOGW("vnd_load_conf: unknown name: %s", p_name);
+		else if (!reload) {
+			conf_base = (char *) &vnd_conf;
+			p_entry->p_action(p_name, p_value, p_entry->param);
+		}
+	}
+
+	fclose(p_file);
+
+	conf_check(p_rt, reload);
+	return 0;
+}
+
+static void rt_conf_publish(const struct mrvl_rt_conf *p_rt)
+{
+	struct rt_conf_node *p_node;
+
+	if (!memcmp(p_rt, vnd_rt_conf_get(), sizeof(*p_rt)))
+		return;
+
+	p_node = malloc(sizeof(*p_node));
+	if (!p_node) {
+		ALOGE("conf: no memory for new tunables");
+		return;
+	}
+	p_node->conf = *p_rt;
+	p_node->next = rt_conf_list;
+	rt_conf_list = p_node;
+
+	__atomic_store_n(&vnd_rt_conf, &p_node->conf, __ATOMIC_RELEASE);
+}
+
+static void conf_reload(void)
+{
+	/* Keys dropped from the file go back to their defaults */
+	struct mrvl_rt_conf rt = rt_conf_default;
+
+	if (conf_parse(watch_path, &rt, TRUE) < 0)
+		return;
+
+	rt_conf_publish(&rt);
+	ALOGI("conf reloaded: lpm idle %u ms, log level %u, open deadline "
+		"%u ms, power on %u tries/%u ms, relay nice %d",
+		rt.lpm_idle_timeout_ms, rt.log_level, rt.open_deadline_ms,
+		rt.power_on_tries, rt.power_on_backoff_ms, rt.relay_nice);
+}
+
+static void *conf_watch_main(void *arg)
+{
+	char buf[sizeof(struct inotify_event) + NAME_MAX + 1]
+		__attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *p_ev;
+	struct pollfd pfd[2];
+	char name[PATH_MAX];
+	const char *p_base;
+	int changed;
+	ssize_t n;
+	char *p;
+
+	strlcpy(name, watch_path, sizeof(name));
+	p_base = basename(name);
+
+	pfd[0].fd = watch_fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = watch_wake[0];
+	pfd[1].events = POLLIN;
+
+	for (;;) {
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			ALOGE("conf watch: poll failed: %s", strerror(errno));
+			break;
+		}
+
+		if (pfd[1].revents)
+			break;
+
+		changed = FALSE;
+		while ((n = read(watch_fd, buf, sizeof(buf))) > 0) {
+			for (p = buf; p < buf + n;
+			     p += sizeof(*p_ev) + p_ev->len) {
+				p_ev = (const struct inotify_event *) p;
+				if (p_ev->len && !strcmp(p_ev->name, p_base))
+					changed = TRUE;
+			}
+		}
+
+		if (changed)
+			conf_reload();
+	}
+
+	return NULL;
+}
+
+/***********************************************************
+ *  Global functions
+ ***********************************************************
+ */
+void vnd_load_conf(const char *p_path)
+{
+	struct mrvl_rt_conf rt = rt_conf_default;
+
+	ALOGI("Attempt to load conf from %s", p_path);
+
+	/* Keys dropped from the file since the last load are not kept */
+	vnd_conf = vnd_conf_default;
+
+	if (conf_parse(p_path, &rt, FALSE) == 0)
+		rt_conf_publish(&rt);
+}
+
+/*
+ * Watch the directory rather than the file: editors and adb push
+ * replace the file, which would silently end a watch on the inode.
+ */
+void vnd_conf_watch_start(const char *p_path)
+{
+	char dir[PATH_MAX];
+
+	if (watch_running)
+		return;
+
+	strlcpy(watch_path, p_path, sizeof(watch_path));
+	strlcpy(dir, p_path, sizeof(dir));
+
+	watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (watch_fd < 0) {
+		ALOGE("conf watch: inotify: %s", strerror(errno));
+		return;
+	}
+	if (inotify_add_watch(watch_fd, dirname(dir),
+			IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		ALOGE("conf watch: cannot watch %s: %s", dir,
+			strerror(errno));
+		goto fail_fd;
+	}
+	if (pipe2(watch_wake, O_CLOEXEC) < 0)
+		goto fail_fd;
+	if (pthread_create(&watch_thread, NULL, conf_watch_main, NULL)) {
+		ALOGE("conf watch: cannot start thread");
+		goto fail_pipe;
+	}
+	watch_running = TRUE;
+	ALOGI("conf watch: reloading tunables on change of %s", p_path);
+	return;
+
+fail_pipe:
+	close(watch_wake[0]);
+	close(watch_wake[1]);
+	watch_wake[0] = watch_wake[1] = -1;
+fail_fd:
+	close(watch_fd);
+	watch_fd = -1;
+}
+
+void vnd_conf_watch_stop(void)
+{
+	struct rt_conf_node *p_node;
+	char c = 0;
+
+	if (watch_running) {
+		if (write(watch_wake[1], &c, 1) < 0)
+			ALOGW("conf watch: wake failed: %s", strerror(errno));
+		pthread_join(watch_thread, NULL);
+		watch_running = FALSE;
+
+		close(watch_wake[0]);
+		close(watch_wake[1]);
+		watch_wake[0] = watch_wake[1] = -1;
+		close(watch_fd);
+		watch_fd = -1;
+	}
+
+	/* Cleanup joined every reader before this, old snapshots can go */
+	__atomic_store_n(&vnd_rt_conf, &rt_conf_default, __ATOMIC_RELEASE);
+	while ((p_node = rt_conf_list)) {
+		rt_conf_list = p_node->next;
+		free(p_node);
+	}
+}
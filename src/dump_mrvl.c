@@ -0,0 +1,262 @@
+/******************************************************************************
+ *
+ *  Copyright (C) 2012 Marvell International Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at:
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+/******************************************************************************
+ *
+ *  Filename:      dump_mrvl.c
+ *
+ *  Description:   Keeps the current vendor lib step, the outstanding
+ *                 vendor command and a short trace ring, and logs them
+ *                 when DumpSignal is delivered to the process.
+ *
+ ******************************************************************************/
+
+#define LOG_TAG "bt_mrvl"
+
+#include <utils/Log.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bt_vendor_mrvl.h"
+
+#define TRACE_SIZE 32  /* power of two */
+
+#define TRACE_STEP 0
+#define TRACE_SENT 1
+#define TRACE_DONE 2
+
+struct trace_ent {
+	uint32_t ms;
+	uint16_t arg;
+	uint8_t kind;
+	uint8_t status;
+};
+
+/***********************************************************
+ *  Local variables
+ ***********************************************************
+ */
+static const char *const step_names[MRVL_STEP_MAX] = {
+	[MRVL_STEP_OFF]          = "off",
+	[MRVL_STEP_POWER_ON]     = "power on",
+	[MRVL_STEP_OPEN]         = "open",
+	[MRVL_STEP_FW_CFG]       = "fw config",
+	[MRVL_STEP_SCO_CFG]      = "sco config",
+	[MRVL_STEP_PCM_UPDATE]   = "pcm update",
+	[MRVL_STEP_LINK_PROFILE] = "link profile",
+	[MRVL_STEP_ON]           = "on",
+};
+
+/*
+ * Written by whichever thread drives the lib, read by the dump thread
+ * without a lock; a dump racing an update may show a torn entry.
+ */
+static volatile int cur_step;
+static volatile uint32_t step_ms;
+static volatile uint16_t pending_cmd;
+static volatile uint32_t pending_ms;
+static struct trace_ent trace[TRACE_SIZE];
+static uint32_t trace_head;
+
+static int dump_pipe[2] = {-1, -1};
+static int dump_signo;
+static struct sigaction dump_old_sa;
+static pthread_t dump_thread;
+static int dump_running;
+
+/***********************************************************
+ *  Local functions
+ ***********************************************************
+ */
+static uint32_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t) (ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+static void trace_add(uint8_t kind, uint16_t arg, uint8_t status)
+{
+	uint32_t i = __atomic_fetch_add(&trace_head, 1, __ATOMIC_RELAXED);
+	struct trace_ent *e = &trace[i & (TRACE_SIZE - 1)];
+
+	e->ms = now_ms();
+	e->kind = kind;
+	e->arg = arg;
+	e->status = status;
+}
+
+/* Only write(2) here: it is async-signal-safe and the pipe never blocks */
+static void dump_signal_handler(int signo)
+{
+	int saved_errno = errno;
+	char c = (char) signo;
+
+	if (write(dump_pipe[1], &c, 1) < 0) {
+		/* A dump is already queued */
+	}
+	errno = saved_errno;
+}
+
+static void dump_state(void)
+{
+	uint32_t now = now_ms();
+	uint32_t head = __atomic_load_n(&trace_head, __ATOMIC_RELAXED);
+	uint32_t i = head > TRACE_SIZE ? head - TRACE_SIZE : 0;
+	const struct trace_ent *e;
+	int step = cur_step;
+
+	ALOGI("dump: step %s for %u ms", step_names[step], now - step_ms);
+	if (pending_cmd)
+		ALOGI("dump: cmd 0x%04hX outstanding for %u ms",
+			pending_cmd, now - pending_ms);
+	else
+		ALOGI("dump: no vendor command outstanding");
+	ALOGI("dump: open retries %u, probe attempts %u, cmd failures %u",
+		vnd_enable_stats.open_retries, vnd_enable_stats.probe_attempts,
+		vnd_enable_stats.cmd_failures);
+	hw_mrvl_dump_state();
+
+	for (; i < head; i++) {
+		e = &trace[i & (TRACE_SIZE - 1)];
+		switch (e->kind) {
+		case TRACE_STEP:
+			ALOGI("dump: -%u ms step %s", now - e->ms,
+				e->arg < MRVL_STEP_MAX ?
+				step_names[e->arg] : "?");
+			break;
+		case TRACE_SENT:
+			ALOGI("dump: -%u ms sent 0x%04hX", now - e->ms, e->arg);
+			break;
+		default:
+			ALOGI("dump: -%u ms done 0x%04hX status 0x%02X",
+				now - e->ms, e->arg, e->status);
+			break;
+		}
+	}
+}
+
+static void *dump_thread_main(void *arg)
+{
+	char c;
+	ssize_t n;
+
+	for (;;) {
+		n = read(dump_pipe[0], &c, 1);
+		if (n < 0 && errno == EINTR)
+			continue;
+		/* Zero is the stop request, or the write end went away */
+		if (n <= 0 || !c)
+			break;
+		dump_state();
+	}
+
+	return NULL;
+}
+
+/***********************************************************
+ *  Global functions
+ ***********************************************************
+ */
+void dump_mrvl_step(int step)
+{
+	cur_step = step;
+	step_ms = now_ms();
+	trace_add(TRACE_STEP, (uint16_t) step, 0);
+}
+
+void dump_mrvl_cmd_sent(uint16_t cmd)
+{
+	pending_ms = now_ms();
+	pending_cmd = cmd;
+	trace_add(TRACE_SENT, cmd, 0);
+}
+
+void dump_mrvl_cmd_done(uint16_t cmd, uint8_t status)
+{
+	if (pending_cmd == cmd)
+		pending_cmd = 0;
+	trace_add(TRACE_DONE, cmd, status);
+}
+
+void dump_mrvl_start(int signo)
+{
+	struct sigaction sa;
+
+	if (dump_running || signo <= 0 || signo >= NSIG)
+		return;
+
+	/* The read end blocks for the thread, the write end never does */
+	if (pipe2(dump_pipe, O_CLOEXEC) < 0) {
+		ALOGE("dump: pipe: %s", strerror(errno));
+		return;
+	}
+	fcntl(dump_pipe[1], F_SETFL, O_NONBLOCK);
+
+	if (pthread_create(&dump_thread, NULL, dump_thread_main, NULL)) {
+		ALOGE("dump: cannot start thread");
+		goto fail_pipe;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = dump_signal_handler;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(signo, &sa, &dump_old_sa) < 0) {
+		ALOGE("dump: cannot catch signal %d: %s", signo,
+			strerror(errno));
+		close(dump_pipe[1]);
+		dump_pipe[1] = -1;
+		pthread_join(dump_thread, NULL);
+		goto fail_pipe;
+	}
+
+	dump_signo = signo;
+	dump_running = TRUE;
+	ALOGI("dump: state logged on signal %d", signo);
+	return;
+
+fail_pipe:
+	close(dump_pipe[0]);
+	if (dump_pipe[1] >= 0)
+		close(dump_pipe[1]);
+	dump_pipe[0] = dump_pipe[1] = -1;
+}
+
+void dump_mrvl_stop(void)
+{
+	char c = 0;
+
+	if (!dump_running)
+		return;
+
+	sigaction(dump_signo, &dump_old_sa, NULL);
+	while (write(dump_pipe[1], &c, 1) < 0 && errno == EAGAIN)
+		usleep(1000);
+	pthread_join(dump_thread, NULL);
+	close(dump_pipe[0]);
+	close(dump_pipe[1]);
+	dump_pipe[0] = dump_pipe[1] = -1;
+	dump_running = FALSE;
+}
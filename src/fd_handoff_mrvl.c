@@ -0,0 +1,185 @@
+/******************************************************************************
+ *
+ *  Copyright (C) 2012 Marvell International Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at:
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+/******************************************************************************
+ *
+ *  Filename:      fd_handoff_mrvl.c
+ *
+ *  Description:   Client side of the port handoff. The open port is parked
+ *                 in mrvl_bt_fdkeeper; if the Bluetooth process dies
+ *                 without closing it, the next instance gets the same fd
+ *                 back and skips power cycle, open and FW config.
+ *
+ ******************************************************************************/
+
+#define LOG_TAG "bt_mrvl"
+
+#include <utils/Log.h>
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "bt_vendor_mrvl.h"
+#include "mrvl_fd_handoff.h"
+
+/* The keeper answers at once; don't hold up enable if it is gone */
+#define KEEPER_TIMEOUT_MS 200
+
+/***********************************************************
+ *  Local functions
+ ***********************************************************
+ */
+static int keeper_connect(void)
+{
+	struct sockaddr_un addr;
+	struct timeval tv;
+	socklen_t len;
+	int sk;
+
+	sk = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sk < 0)
+		return -1;
+
+	tv.tv_sec = 0;
+	tv.tv_usec = KEEPER_TIMEOUT_MS * 1000;
+	setsockopt(sk, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(sk, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	/* Abstract namespace: leading NUL, no file system entry */
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strlcpy(addr.sun_path + 1, MRVL_FD_KEEPER_SOCKET,
+		sizeof(addr.sun_path) - 1);
+	len = offsetof(struct sockaddr_un, sun_path) + 1 +
+		strlen(MRVL_FD_KEEPER_SOCKET);
+
+	if (connect(sk, (struct sockaddr *) &addr, len) < 0) {
+		ALOGD("fd keeper not reachable: %s", strerror(errno));
+		close(sk);
+		return -1;
+	}
+
+	return sk;
+}
+
+static int keeper_send(uint8_t op, int fd)
+{
+	char ctrl[CMSG_SPACE(sizeof(int))];
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	int sk;
+	int ret;
+
+	sk = keeper_connect();
+	if (sk < 0)
+		return -1;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &op;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	if (fd >= 0) {
+		msg.msg_control = ctrl;
+		msg.msg_controllen = sizeof(ctrl);
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	}
+
+	ret = sendmsg(sk, &msg, 0) == 1 ? 0 : -1;
+	close(sk);
+
+	return ret;
+}
+
+/***********************************************************
+ *  Global functions
+ ***********************************************************
+ */
+
+/* Fetch a port whose controller is already configured, -1 if none */
+int fd_handoff_mrvl_get(void)
+{
+	char ctrl[CMSG_SPACE(sizeof(int))];
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	uint8_t op = FD_OP_GET;
+	uint8_t status = FD_NONE;
+	int fd = -1;
+	int sk;
+
+	if (!vnd_conf.fd_handoff)
+		return -1;
+
+	sk = keeper_connect();
+	if (sk < 0)
+		return -1;
+
+	if (write(sk, &op, 1) != 1)
+		goto out;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &status;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctrl;
+	msg.msg_controllen = sizeof(ctrl);
+
+	if (recvmsg(sk, &msg, MSG_CMSG_CLOEXEC) != 1 || status != FD_HEALTHY)
+		goto out;
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg && cmsg->cmsg_level == SOL_SOCKET &&
+			cmsg->cmsg_type == SCM_RIGHTS)
+		memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+
+out:
+	close(sk);
+	if (fd >= 0)
+		ALOGI("Took over configured port from fd keeper");
+	return fd;
+}
+
+void fd_handoff_mrvl_put(int fd)
+{
+	if (vnd_conf.fd_handoff && keeper_send(FD_OP_PUT, fd) < 0)
+		ALOGW("Cannot park port with fd keeper");
+}
+
+void fd_handoff_mrvl_healthy(void)
+{
+	if (vnd_conf.fd_handoff)
+		keeper_send(FD_OP_HEALTHY, -1);
+}
+
+void fd_handoff_mrvl_drop(void)
+{
+	if (vnd_conf.fd_handoff)
+		keeper_send(FD_OP_DROP, -1);
+}
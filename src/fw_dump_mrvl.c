@@ -0,0 +1,409 @@
+/******************************************************************************
+ *
+ *  Copyright (C) 2012 Marvell International Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at:
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+/******************************************************************************
+ *
+ *  Filename:      fw_dump_mrvl.c
+ *
+ *  Description:   Captures a firmware dump after a controller fault. The
+ *                 driver is asked for the dump, which is then read in
+ *                 fixed chunks and gzip compressed into FwDumpFile within
+ *                 FwDumpBudgetMs. The port is not closed before it ends.
+ *
+ ******************************************************************************/
+
+#define LOG_TAG "bt_mrvl"
+
+#include <utils/Log.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "bt_vendor_mrvl.h"
+
+#define DUMP_CHUNK        4096
+#define DUMP_POLL_MS      50
+
+/* devcoredump keeps each dump in its own devcdN directory */
+#define DEVCOREDUMP_DIR   "/sys/class/devcoredump"
+#define TTY_CLASS_DIR     "/sys/class/tty"
+
+/* gzip wrapper, 4 KB window and small hash: about 20 KB of zlib state */
+#define DUMP_WINDOW_BITS  (12 + 16)
+#define DUMP_MEM_LEVEL    4
+
+/***********************************************************
+ *  Local variables
+ ***********************************************************
+ */
+/*
+ * dump_lock covers dump_thread and dump_running; wait_lock lets one
+ * caller at a time join, so the thread is never joined twice.
+ */
+static pthread_mutex_t dump_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t wait_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t dump_thread;
+static int dump_running;
+static uint8_t dump_code;
+
+static uint32_t last_ms;
+static uint32_t last_raw;
+static uint32_t last_gz;
+static int last_complete;
+static uint32_t dump_count;
+
+/***********************************************************
+ *  Local functions
+ ***********************************************************
+ */
+static uint32_t ms_since(const struct timespec *p_start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint32_t) ((now.tv_sec - p_start->tv_sec) * 1000 +
+		(now.tv_nsec - p_start->tv_nsec) / 1000000);
+}
+
+static int write_full(int fd, const uint8_t *p, size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		n = write(fd, p, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/* Ask the driver for a dump; nothing to do if it dumps on its own */
+static void dump_trigger(void)
+{
+	int fd;
+
+	if (!vnd_conf.fw_dump_trigger[0])
+		return;
+
+	fd = open(vnd_conf.fw_dump_trigger, O_WRONLY | O_CLOEXEC);
+	if (fd < 0 || write(fd, "1", 1) != 1)
+		ALOGW("fw dump: cannot trigger through %s: %s",
+			vnd_conf.fw_dump_trigger, strerror(errno));
+	if (fd >= 0)
+		close(fd);
+}
+
+/* Last path component of the sysfs link at path, FALSE if none */
+static int link_name(const char *path, char *name, size_t size)
+{
+	char target[PATH_MAX];
+	ssize_t n;
+
+	n = readlink(path, target, sizeof(target) - 1);
+	if (n <= 0)
+		return FALSE;
+	target[n] = '\0';
+	strlcpy(name, basename(target), size);
+	return TRUE;
+}
+
+/*
+ * Device name devcoredump reports as failing_device for our controller:
+ * FwDumpDevice, or for UART the device behind the tty.
+ */
+static int dump_device(char *name, size_t size)
+{
+	char path[PATH_MAX];
+	char port[MRVL_CONF_STR_LEN];
+
+	if (vnd_conf.fw_dump_device[0]) {
+		strlcpy(name, vnd_conf.fw_dump_device, size);
+		return TRUE;
+	}
+
+	if (vnd_conf.transport != MRVL_TRANSPORT_UART)
+		return FALSE;
+
+	strlcpy(port, vnd_conf.uart_port, sizeof(port));
+	snprintf(path, sizeof(path), "%s/%s/device", TTY_CLASS_DIR,
+		basename(port));
+	return link_name(path, name, size);
+}
+
+/* devcdN directory holding our controller's dump, FALSE if none yet */
+static int devcd_find(const char *device, char *path, size_t size)
+{
+	char link[PATH_MAX];
+	char name[NAME_MAX + 1];
+	struct dirent *de;
+	DIR *dir;
+	int found = FALSE;
+
+	dir = opendir(DEVCOREDUMP_DIR);
+	if (!dir)
+		return FALSE;
+
+	/* Other drivers' dumps may sit here too, match the device */
+	while (!found && (de = readdir(dir))) {
+		if (strncmp(de->d_name, "devcd", 5))
+			continue;
+		snprintf(link, sizeof(link), "%s/%s/failing_device",
+			DEVCOREDUMP_DIR, de->d_name);
+		if (!link_name(link, name, sizeof(name)) ||
+				strcmp(name, device))
+			continue;
+		snprintf(path, size, "%s/%s/data", DEVCOREDUMP_DIR,
+			de->d_name);
+		found = TRUE;
+	}
+	closedir(dir);
+
+	return found;
+}
+
+/* Open the dump once the driver has it, or -1 at the budget */
+static int dump_open_source(const struct timespec *p_start, char *path,
+		size_t size)
+{
+	char device[NAME_MAX + 1];
+	int devcd;
+	int fd;
+
+	devcd = !strcmp(vnd_conf.fw_dump_source, DEVCOREDUMP_DIR);
+	if (devcd && !dump_device(device, sizeof(device))) {
+		ALOGW("fw dump: set FwDumpDevice to pick the dump from %s",
+			DEVCOREDUMP_DIR);
+		return -1;
+	}
+
+	for (;;) {
+		path[0] = '\0';
+		if (!devcd)
+			strlcpy(path, vnd_conf.fw_dump_source, size);
+		else
+			devcd_find(device, path, size);
+
+		if (path[0]) {
+			fd = open(path, O_RDONLY | O_CLOEXEC);
+			if (fd >= 0)
+				return fd;
+		}
+
+		if (ms_since(p_start) >= vnd_conf.fw_dump_budget_ms)
+			return -1;
+		usleep(DUMP_POLL_MS * 1000);
+	}
+}
+
+/*
+ * Stream src into out through deflate, DUMP_CHUNK at a time. Returns
+ * TRUE if the source was read to the end within the budget; the gzip
+ * stream is closed properly either way.
+ */
+static int dump_stream(int src, int out, const struct timespec *p_start)
+{
+	uint8_t in_buf[DUMP_CHUNK];
+	uint8_t out_buf[DUMP_CHUNK];
+	struct pollfd pfd;
+	z_stream zs;
+	int complete = FALSE;
+	int flush = Z_NO_FLUSH;
+	uint32_t left;
+	ssize_t n;
+	int err;
+
+	memset(&zs, 0, sizeof(zs));
+	if (deflateInit2(&zs, Z_BEST_SPEED, Z_DEFLATED, DUMP_WINDOW_BITS,
+			DUMP_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK) {
+		ALOGE("fw dump: deflateInit failed");
+		return FALSE;
+	}
+
+	pfd.fd = src;
+	pfd.events = POLLIN;
+
+	while (flush != Z_FINISH) {
+		left = vnd_conf.fw_dump_budget_ms - ms_since(p_start);
+		if ((int32_t) left <= 0) {
+			ALOGW("fw dump: out of time, dump truncated");
+			flush = Z_FINISH;
+			n = 0;
+		} else if (poll(&pfd, 1, left) <= 0) {
+			/* Driver stopped producing, keep what we have */
+			flush = Z_FINISH;
+			n = 0;
+		} else {
+			n = read(src, in_buf, sizeof(in_buf));
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0) {
+				complete = n == 0;
+				flush = Z_FINISH;
+				n = 0;
+			}
+		}
+
+		last_raw += n;
+		zs.next_in = in_buf;
+		zs.avail_in = n;
+		do {
+			zs.next_out = out_buf;
+			zs.avail_out = sizeof(out_buf);
+			err = deflate(&zs, flush);
+			if (err == Z_STREAM_ERROR)
+				break;
+			n = sizeof(out_buf) - zs.avail_out;
+			if (write_full(out, out_buf, n) < 0) {
+				ALOGE("fw dump: write failed: %s",
+					strerror(errno));
+				deflateEnd(&zs);
+				return FALSE;
+			}
+			last_gz += n;
+		} while (!zs.avail_out);
+	}
+
+	deflateEnd(&zs);
+	return complete;
+}
+
+static void *dump_thread_main(void *arg)
+{
+	char src_path[PATH_MAX];
+	char tmp_path[MRVL_CONF_STR_LEN + 4];
+	struct timespec start;
+	int src;
+	int out;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	last_raw = last_gz = 0;
+	last_complete = FALSE;
+
+	dump_trigger();
+	src = dump_open_source(&start, src_path, sizeof(src_path));
+	if (src < 0) {
+		ALOGE("fw dump: no dump from the driver within %u ms",
+			vnd_conf.fw_dump_budget_ms);
+		goto done;
+	}
+
+	/* Only a finished dump replaces the previous one */
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", vnd_conf.fw_dump_file);
+	out = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0660);
+	if (out < 0) {
+		ALOGE("fw dump: cannot create %s: %s", tmp_path,
+			strerror(errno));
+		close(src);
+		goto done;
+	}
+
+	last_complete = dump_stream(src, out, &start);
+	close(src);
+	if (fsync(out) < 0 || close(out) < 0 ||
+			rename(tmp_path, vnd_conf.fw_dump_file) < 0)
+		ALOGE("fw dump: cannot store %s: %s", vnd_conf.fw_dump_file,
+			strerror(errno));
+
+	/* devcoredump frees the dump once its data file is written to */
+	if (!strcmp(vnd_conf.fw_dump_source, DEVCOREDUMP_DIR)) {
+		src = open(src_path, O_WRONLY | O_CLOEXEC);
+		if (src >= 0) {
+			if (write(src, "1", 1) < 0)
+				ALOGW("fw dump: cannot release %s", src_path);
+			close(src);
+		}
+	}
+
+done:
+	last_ms = ms_since(&start);
+	dump_count++;
+	ALOGI("fw dump for fault 0x%02X: %s, %u bytes -> %u compressed "
+		"in %u ms", dump_code, last_complete ? "complete" : "partial",
+		last_raw, last_gz, last_ms);
+	return NULL;
+}
+
+/***********************************************************
+ *  Global functions
+ ***********************************************************
+ */
+
+/* Start capturing; the caller must not block on it */
+void fw_dump_mrvl_start(uint8_t code)
+{
+	if (!vnd_conf.fw_dump_file[0] || !vnd_conf.fw_dump_source[0])
+		return;
+
+	pthread_mutex_lock(&dump_lock);
+	if (!dump_running) {
+		dump_code = code;
+		if (pthread_create(&dump_thread, NULL, dump_thread_main, NULL))
+			ALOGE("fw dump: cannot start thread");
+		else
+			dump_running = TRUE;
+	}
+	pthread_mutex_unlock(&dump_lock);
+}
+
+/* Hold recovery (port close, power off) until the capture has ended */
+void fw_dump_mrvl_wait(void)
+{
+	int running;
+
+	pthread_mutex_lock(&wait_lock);
+
+	pthread_mutex_lock(&dump_lock);
+	running = dump_running;
+	pthread_mutex_unlock(&dump_lock);
+
+	/* Still running, so start leaves dump_thread alone meanwhile */
+	if (running) {
+		ALOGI("fw dump: waiting for capture before recovery");
+		pthread_join(dump_thread, NULL);
+		pthread_mutex_lock(&dump_lock);
+		dump_running = FALSE;
+		pthread_mutex_unlock(&dump_lock);
+	}
+
+	pthread_mutex_unlock(&wait_lock);
+}
+
+void fw_dump_mrvl_dump_stats(void)
+{
+	if (!dump_count)
+		return;
+
+	ALOGI("fw dumps %u, last: %s, %u bytes -> %u compressed in %u ms",
+		dump_count, last_complete ? "complete" : "partial", last_raw,
+		last_gz, last_ms);
+}
@@ -0,0 +1,290 @@
+/******************************************************************************
+ *
+ *  Copyright (C) 2012 Marvell International Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at:
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+/******************************************************************************
+ *
+ *  Filename:      fw_loader_mrvl.c
+ *
+ *  Description:   Firmware download over UART for Marvell bootloaders
+ *
+ *  The bootloader drives the transfer. It keeps sending a 5 byte header
+ *  (0xA5, len, ~len) asking for the next len bytes; the host acks and sends
+ *  exactly that much. An odd len asks for the previous chunk again, a zero
+ *  len ends the download.
+ *
+ ******************************************************************************/
+
+#define LOG_TAG "bt_mrvl"
+
+#include <utils/Log.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "bt_vendor_mrvl.h"
+
+#define FW_HDR_START         0xA5
+#define FW_HDR_SIZE          5
+#define FW_ACK               0x5A
+#define FW_NAK               0xBF
+
+/* Give up after this many bad headers or resend requests in a row */
+#define FW_MAX_RETRY         10
+
+/* Wait for an HCI answer before assuming a bootloader is listening */
+#define FW_RUNNING_PROBE_MS  50
+
+/* Time the firmware needs after the last chunk before it answers HCI */
+#define FW_BOOT_DELAY_MS     100
+
+/***********************************************************
+ *  Local functions
+ ***********************************************************
+ */
+static int fw_read_full(int fd, uint8_t *p, int len, uint32_t timeout_ms)
+{
+	struct pollfd pfd;
+	int got = 0;
+	int n;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	while (got < len) {
+		n = poll(&pfd, 1, timeout_ms);
+		if (n <= 0)
+			return n < 0 && errno != EINTR ? -1 : got;
+
+		n = read(fd, p + got, len - got);
+		if (n < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			return -1;
+		}
+		got += n;
+	}
+
+	return got;
+}
+
+static int fw_write_full(int fd, const uint8_t *p, int len)
+{
+	int n;
+
+	while (len > 0) {
+		n = write(fd, p, len);
+		if (n < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/*
+ * Wait for the next valid bootloader header and return the requested
+ * length. Returns -1 on timeout or I/O error.
+ */
+static int fw_wait_header(int fd, uint32_t timeout_ms)
+{
+	uint8_t hdr[FW_HDR_SIZE];
+	uint16_t len, nlen;
+	int bad = 0;
+
+	while (bad < FW_MAX_RETRY) {
+		/* Hunt for the start byte, the line may carry garbage */
+		do {
+			if (fw_read_full(fd, hdr, 1, timeout_ms) != 1)
+				return -1;
+		} while (hdr[0] != FW_HDR_START);
+
+		if (fw_read_full(fd, hdr + 1, FW_HDR_SIZE - 1, timeout_ms) !=
+				FW_HDR_SIZE - 1)
+			return -1;
+
+		len = hdr[1] | (hdr[2] << 8);
+		nlen = hdr[3] | (hdr[4] << 8);
+		if ((uint16_t) (len ^ nlen) == 0xFFFF) {
+			if (fw_write_full(fd, (const uint8_t[]) { FW_ACK }, 1) < 0)
+				return -1;
+			return len;
+		}
+
+		ALOGW("fw download: bad header len 0x%04X/0x%04X", len, nlen);
+		bad++;
+		if (fw_write_full(fd, (const uint8_t[]) { FW_NAK }, 1) < 0)
+			return -1;
+	}
+
+	return -1;
+}
+
+/*
+ * Stream one image to the bootloader. Returns 1 if the image was sent,
+ * 0 if no bootloader answered (firmware already running) and -1 on error.
+ */
+static int fw_download_image(int fd, const char *path, uint32_t timeout_ms)
+{
+	struct stat st;
+	const uint8_t *p_img;
+	uint32_t offset = 0;
+	uint32_t last_len = 0;
+	int retry = 0;
+	int len;
+	int ret = -1;
+	int img_fd;
+
+	img_fd = open(path, O_RDONLY);
+	if (img_fd < 0) {
+		ALOGE("fw download: cannot open %s: %s", path, strerror(errno));
+		return -1;
+	}
+
+	if (fstat(img_fd, &st) < 0 || st.st_size == 0) {
+		ALOGE("fw download: cannot size %s", path);
+		close(img_fd);
+		return -1;
+	}
+
+	p_img = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, img_fd, 0);
+	close(img_fd);
+	if (p_img == MAP_FAILED) {
+		ALOGE("fw download: cannot map %s: %s", path, strerror(errno));
+		return -1;
+	}
+	madvise((void *) p_img, st.st_size, MADV_SEQUENTIAL);
+
+	ALOGI("fw download: %s (%ld bytes)", path, (long) st.st_size);
+
+	for (;;) {
+		len = fw_wait_header(fd, timeout_ms);
+		if (len < 0) {
+			if (offset == 0 && last_len == 0) {
+				ALOGI("fw download: no bootloader, fw running");
+				ret = 0;
+			} else {
+				ALOGE("fw download: lost bootloader at %u/%ld",
+					offset, (long) st.st_size);
+			}
+			break;
+		}
+
+		if (len == 0) {
+			ret = 1;
+			break;
+		}
+
+		if (len & 0x01) {
+			/* CRC error on the previous chunk, send it again */
+			if (++retry > FW_MAX_RETRY) {
+				ALOGE("fw download: too many resends at %u",
+					offset);
+				break;
+			}
+			len &= ~0x01;
+		} else {
+			retry = 0;
+			offset += last_len;
+		}
+
+		if (offset + len > (uint32_t) st.st_size) {
+			ALOGE("fw download: request past end (%u+%d/%ld)",
+				offset, len, (long) st.st_size);
+			break;
+		}
+
+		/* One write per requested chunk, straight from the mapping */
+		if (fw_write_full(fd, p_img + offset, len) < 0) {
+			ALOGE("fw download: write failed: %s", strerror(errno));
+			break;
+		}
+		last_len = len;
+	}
+
+	munmap((void *) p_img, st.st_size);
+	return ret;
+}
+
+/***********************************************************
+ *  Global functions
+ ***********************************************************
+ */
+int fw_loader_mrvl_download(int fd)
+{
+	struct timespec start, end;
+	uint32_t timeout = vnd_conf.uart_fw_timeout_ms;
+	int ret;
+
+	if (!vnd_conf.uart_fw_file[0])
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	/*
+	 * On a warm enable the firmware is up and no bootloader header will
+	 * come; do not sit out UartFwTimeoutMs waiting for one.
+	 */
+	if (userial_mrvl_ping(fd, FW_RUNNING_PROBE_MS) == 0) {
+		ALOGI("fw download: firmware already running");
+		return 0;
+	}
+	/* A bootloader saw the probe as line noise; it repeats its header */
+	tcflush(fd, TCIOFLUSH);
+
+	if (vnd_conf.uart_helper_file[0]) {
+		ret = fw_download_image(fd, vnd_conf.uart_helper_file, timeout);
+		if (ret < 0)
+			return -1;
+
+		/* The helper takes over at its own, faster rate */
+		if (ret > 0 && vnd_conf.uart_fw_baud &&
+				userial_mrvl_set_baud(fd, vnd_conf.uart_fw_baud) < 0)
+			return -1;
+		tcflush(fd, TCIOFLUSH);
+	}
+
+	ret = fw_download_image(fd, vnd_conf.uart_fw_file, timeout);
+
+	/* Firmware comes up at the boot rate whatever the helper used */
+	if (vnd_conf.uart_helper_file[0] && vnd_conf.uart_fw_baud)
+		userial_mrvl_set_baud(fd, vnd_conf.uart_baud);
+
+	if (ret < 0)
+		return -1;
+
+	if (ret > 0) {
+		usleep(FW_BOOT_DELAY_MS * 1000);
+		tcflush(fd, TCIOFLUSH);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		ALOGI("fw download done in %ld ms",
+			(long) ((end.tv_sec - start.tv_sec) * 1000 +
+			(end.tv_nsec - start.tv_nsec) / 1000000));
+	}
+
+	return 0;
+}
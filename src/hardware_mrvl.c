@@ -31,11 +31,16 @@
 #include <unistd.h>
 #include <signal.h>
 #include <sys/types.h>
+#include <sys/ioctl.h>
 #include <sys/select.h>
 #include <sys/mman.h>
 
 #include "bt_vendor_lib.h"
 #include "bt_hci_bdroid.h"
+#include "bt_vendor_mrvl.h"
+#ifdef MRVL_BOARD_PROFILE
+#include "mrvl_board_cmds.h"
+#endif
 
 #include "marvell_wireless.h"
 
@@ -44,17 +49,35 @@
 #define HCI_CMD_MARVELL_WRITE_PCM_LINK_SETTINGS 0xFC29
 #define HCI_CMD_MARVELL_SET_SCO_DATA_PATH       0xFC1D
 #define HCI_CMD_MARVELL_WRITE_BD_ADDRESS        0xFC22
+#define HCI_CMD_MARVELL_SET_UART_BAUD           0xFC09
+#define HCI_CMD_READ_LOCAL_VERSION              0x1001
+#define HCI_CMD_QOS_SETUP                       0x0807
+#define HCI_CMD_READ_LINK_POLICY                0x080C
+#define HCI_CMD_WRITE_LINK_POLICY               0x080D
 
 #define WRITE_PCM_SETTINGS_SIZE            1
 #define WRITE_PCM_SYNC_SETTINGS_SIZE       3
 #define WRITE_PCM_LINK_SETTINGS_SIZE       2
 #define SET_SCO_DATA_PATH_SIZE             1
 #define WRITE_BD_ADDRESS_SIZE              8
+#define SET_UART_BAUD_SIZE                 4
+#define QOS_SETUP_SIZE                     20
+#define WRITE_LINK_POLICY_SIZE             4
+
+/* Link policy bits that let a link leave active mode */
+#define LINK_POLICY_LOW_POWER              0x000E
+
+/* QoS Setup service types */
+#define QOS_BEST_EFFORT                    0x01
+#define QOS_GUARANTEED                     0x02
 
 
 #define HCI_CMD_PREAMBLE_SIZE 3
 
 #define HCI_EVT_CMD_CMPL_OPCODE 3
+#define HCI_EVT_CMD_STATUS      0x0F
+#define HCI_EVT_CMD_STAT_STATUS 2
+#define HCI_EVT_CMD_STAT_OPCODE 4
 
 #define STREAM_TO_UINT16(u16, p) \
 do { \
@@ -73,14 +96,65 @@ struct bt_evt_param_t {
 	uint8_t cmd_ret_param;
 };
 
+/* PCM role, bit 1 of the WRITE_PCM_SETTINGS payload */
+#define PCM_ROLE_SLAVE   0x00
+#define PCM_ROLE_MASTER  0x02
+
+/*
+ * PCM bus setup for one codec/SoC pairing. Each field maps onto the
+ * payload bytes of the Marvell PCM commands:
+ *   WRITE_PCM_SETTINGS      { role }
+ *   WRITE_PCM_SYNC_SETTINGS { sync_mode, sync_cfg, clock_rate }
+ *   WRITE_PCM_LINK_SETTINGS { slot & 0xFF, slot >> 8 }
+ */
+struct pcm_profile {
+	const char *name;
+	uint8_t role;
+	uint8_t sync_mode;
+	uint8_t sync_cfg;
+	uint8_t clock_rate;
+	uint16_t slot;
+};
+
 /* ioctl command to release the read thread before driver close */
 #define MBTCHAR_IOCTL_RELEASE _IO('M', 1)
 
 #define VERSION "M002"
 
-static const char mchar_port[] = "/dev/mbtchar0";
+/* Port of the selected transport; mchar_fd holds it for either */
 static int mchar_fd = -1;
 
+/* UART baud rate upshift state */
+static uint32_t uart_cur_baud;
+static volatile int baud_verify_pending;
+static timer_t baud_verify_timer;
+static int baud_verify_timer_created;
+static struct timespec baud_switch_start;
+
+/* POWER_CTRL outcomes since the lib was loaded */
+static uint32_t power_on_ok;
+static uint32_t power_on_retried;
+static uint32_t power_on_failed;
+static uint32_t power_off_failed;
+
+/* Port handed over by the fd keeper, controller already configured */
+static int handoff_fd = -1;
+static int handoff_warm;
+
+/* Low latency command chain in flight; cleared when it ends or dies */
+static volatile int ll_busy;
+
+/*
+ * The stack's buffer free hook, kept across cleanup: a completion that
+ * arrives after it still hands us a buffer from the stack's pool.
+ */
+static mdealloc_cb evt_dealloc;
+
+/* Enable phase timestamps */
+static struct timespec enable_start;
+static struct timespec phase_start;
+static uint64_t enable_cpu_start_ms;
+
 /***********************************************************
  *  Externs
  ***********************************************************
@@ -88,6 +162,12 @@ static int mchar_fd = -1;
 extern unsigned char vnd_local_bd_addr[6];
 extern bt_vendor_callbacks_t *bt_vendor_cbacks;
 
+/***********************************************************
+ *  Global variables
+ ***********************************************************
+ */
+struct mrvl_enable_stats vnd_enable_stats;
+
 /***********************************************************
  *  Local variables
  ***********************************************************
@@ -107,10 +187,27 @@ static uint8_t write_pcm_link_settings[WRITE_PCM_LINK_SETTINGS_SIZE] = {
 	0x00
 };
 
+/* What the controller holds since the last successful PCM config */
+static uint8_t applied_pcm_settings[WRITE_PCM_SETTINGS_SIZE];
+static uint8_t applied_pcm_sync_settings[WRITE_PCM_SYNC_SETTINGS_SIZE];
+static uint8_t applied_pcm_link_settings[WRITE_PCM_LINK_SETTINGS_SIZE];
+static int pcm_applied;
+
+static const struct pcm_profile pcm_profiles[] = {
+	/* name       role             sync  cfg   clock slot */
+	{ "default",  PCM_ROLE_MASTER, 0x03, 0x00, 0x03, 0x0003 },
+	{ "slave",    PCM_ROLE_SLAVE,  0x03, 0x00, 0x03, 0x0003 },
+	{ "slave_slot1", PCM_ROLE_SLAVE, 0x03, 0x00, 0x03, 0x0001 },
+};
+
+static const struct pcm_profile *pcm_profile = &pcm_profiles[0];
+
 static uint8_t set_sco_data_path[SET_SCO_DATA_PATH_SIZE] = {
 	0x01
 };
 
+static uint8_t set_uart_baud[SET_UART_BAUD_SIZE];
+
 static uint8_t write_bd_address[WRITE_BD_ADDRESS_SIZE] = {
 	0xFE, /* Parameter ID */
 	0x06, /* bd_addr length */
@@ -140,6 +237,16 @@ static char *cmd_to_str(uint16_t cmd)
 		return "set_sco_data_path";
 	case HCI_CMD_MARVELL_WRITE_BD_ADDRESS:
 		return "write_bd_address";
+	case HCI_CMD_MARVELL_SET_UART_BAUD:
+		return "set_uart_baud";
+	case HCI_CMD_READ_LOCAL_VERSION:
+		return "read_local_version";
+	case HCI_CMD_QOS_SETUP:
+		return "qos_setup";
+	case HCI_CMD_READ_LINK_POLICY:
+		return "read_link_policy";
+	case HCI_CMD_WRITE_LINK_POLICY:
+		return "write_link_policy";
 	default:
 		break;
 	}
@@ -147,6 +254,15 @@ static char *cmd_to_str(uint16_t cmd)
 	return "unknown command";
 }
 
+static const char *port_name(void)
+{
+	if (vnd_conf.transport == MRVL_TRANSPORT_UART)
+		return vnd_conf.uart_port;
+
+	return vnd_conf.mchar_port;
+}
+
+#ifndef MRVL_BOARD_BD_ADDRESS
 static void populate_bd_addr_params(uint8_t *params, uint8_t *addr)
 {
 	assert(params && addr);
@@ -158,15 +274,51 @@ static void populate_bd_addr_params(uint8_t *params, uint8_t *addr)
 	*params++ = addr[1];
 	*params   = addr[0];
 }
+#endif
+
+#ifdef MRVL_BOARD_PROFILE
+/* Command image baked from the board profile, NULL if built at run time */
+static const uint8_t *board_cmd_image(uint16_t cmd, uint16_t *p_len)
+{
+	switch (cmd) {
+	case HCI_CMD_MARVELL_WRITE_PCM_SETTINGS:
+		*p_len = sizeof(board_cmd_write_pcm_settings);
+		return board_cmd_write_pcm_settings;
+	case HCI_CMD_MARVELL_WRITE_PCM_SYNC_SETTINGS:
+		*p_len = sizeof(board_cmd_write_pcm_sync_settings);
+		return board_cmd_write_pcm_sync_settings;
+	case HCI_CMD_MARVELL_WRITE_PCM_LINK_SETTINGS:
+		*p_len = sizeof(board_cmd_write_pcm_link_settings);
+		return board_cmd_write_pcm_link_settings;
+	case HCI_CMD_MARVELL_SET_SCO_DATA_PATH:
+		*p_len = sizeof(board_cmd_set_sco_data_path);
+		return board_cmd_set_sco_data_path;
+#ifdef MRVL_BOARD_BD_ADDRESS
+	case HCI_CMD_MARVELL_WRITE_BD_ADDRESS:
+		*p_len = sizeof(board_cmd_write_bd_address);
+		return board_cmd_write_bd_address;
+#endif
+	default:
+		break;
+	}
+
+	return NULL;
+}
+#endif
 
 static HC_BT_HDR *build_cmd_buf(uint16_t cmd, uint8_t pl_len, uint8_t *payload)
 {
 	HC_BT_HDR *p_buf = NULL;
 	uint16_t cmd_len = HCI_CMD_PREAMBLE_SIZE + pl_len;
+	const uint8_t *p_img = NULL;
 	uint8_t *p = NULL;
 
 	assert(payload);
 
+#ifdef MRVL_BOARD_PROFILE
+	p_img = board_cmd_image(cmd, &cmd_len);
+#endif
+
 	if (bt_vendor_cbacks)
 		p_buf = (HC_BT_HDR *) bt_vendor_cbacks->alloc(BT_HC_HDR_SIZE + cmd_len);
 
@@ -180,6 +332,11 @@ static HC_BT_HDR *build_cmd_buf(uint16_t cmd, uint8_t pl_len, uint8_t *payload)
 
 	p = (uint8_t *) (p_buf + 1);
 
+	if (p_img) {
+		memcpy(p, p_img, cmd_len);
+		return p_buf;
+	}
+
 	/* opcode */
 	UINT16_TO_STREAM(p, cmd);
 
@@ -200,34 +357,269 @@ static void parse_evt_buf(HC_BT_HDR *p_evt_buf,
 
 	assert(p_evt_buf && evt_params);
 
+	if (*(uint8_t *) (p_evt_buf + 1) == HCI_EVT_CMD_STATUS) {
+		/* Commands with their own completion event answer this way */
+		p = (uint8_t *) (p_evt_buf + 1) + HCI_EVT_CMD_STAT_OPCODE;
+		STREAM_TO_UINT16(evt_params->cmd, p);
+		evt_params->cmd_ret_param =
+			((uint8_t *) (p_evt_buf + 1))[HCI_EVT_CMD_STAT_STATUS];
+		dump_mrvl_cmd_done(evt_params->cmd, evt_params->cmd_ret_param);
+		return;
+	}
+
 	/* opcode */
 	STREAM_TO_UINT16(evt_params->cmd, p);
 
 	/* command return parameter */
 	evt_params->cmd_ret_param = *p;
+
+	dump_mrvl_cmd_done(evt_params->cmd, evt_params->cmd_ret_param);
+}
+
+/* Free an event of a chain the lib has been cleaned up under */
+static void drop_evt_buf(HC_BT_HDR *p_evt_buf, const char *chain)
+{
+	ALOGW("Drop %s event after cleanup", chain);
+	if (evt_dealloc)
+		evt_dealloc(p_evt_buf);
+}
+
+#ifndef MRVL_BOARD_PROFILE
+static const struct pcm_profile *pcm_profile_find(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(pcm_profiles) / sizeof(pcm_profiles[0]); i++)
+		if (!strcmp(pcm_profiles[i].name, name))
+			return &pcm_profiles[i];
+
+	return NULL;
+}
+#endif
+
+static void pcm_profile_encode(const struct pcm_profile *prof)
+{
+	write_pcm_settings[0] = prof->role;
+	write_pcm_sync_settings[0] = prof->sync_mode;
+	write_pcm_sync_settings[1] = prof->sync_cfg;
+	write_pcm_sync_settings[2] = prof->clock_rate;
+	write_pcm_link_settings[0] = (uint8_t) prof->slot;
+	write_pcm_link_settings[1] = (uint8_t) (prof->slot >> 8);
+}
+
+static uint32_t ms_since(const struct timespec *p_start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint32_t) ((now.tv_sec - p_start->tv_sec) * 1000 +
+		(now.tv_nsec - p_start->tv_nsec) / 1000000);
+}
+
+static uint64_t cpu_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Close the books on this enable, whichever phase it ended in */
+static void hw_mrvl_enable_done(bt_vendor_op_result_t result)
+{
+	struct mrvl_enable_stats *st = &vnd_enable_stats;
+
+	st->total_ms = ms_since(&enable_start);
+	st->cpu_ms = (uint32_t) (cpu_now_ms() - enable_cpu_start_ms);
+	st->result = result;
+
+	ALOGI("Enable %s: power %u ms, open %u ms (%u retries), "
+		"probe %u ms (%u tries), fwcfg %u ms, total %u ms, cpu %u ms",
+		result == BT_VND_OP_RESULT_SUCCESS ? "done" : "failed",
+		st->power_ms, st->open_ms, st->open_retries, st->probe_ms,
+		st->probe_attempts, st->fwcfg_ms, st->total_ms, st->cpu_ms);
+
+	pm_qos_mrvl_release(PM_QOS_ENABLE);
+	journal_mrvl_record(st);
+}
+
+static void hw_mrvl_fwcfg_done(bt_vendor_op_result_t result)
+{
+	vnd_enable_stats.fwcfg_ms = ms_since(&phase_start);
+	if (result != BT_VND_OP_RESULT_SUCCESS)
+		vnd_enable_stats.cmd_failures++;
+	hw_mrvl_enable_done(result);
+	dump_mrvl_step(result == BT_VND_OP_RESULT_SUCCESS ?
+		MRVL_STEP_ON : MRVL_STEP_OFF);
+	if (result == BT_VND_OP_RESULT_SUCCESS)
+		fd_handoff_mrvl_healthy();
+	bt_vendor_cbacks->fwcfg_cb(result);
+}
+
+static void hw_mrvl_scocfg_done(bt_vendor_op_result_t result)
+{
+	pm_qos_mrvl_release(PM_QOS_SCO_CFG);
+	dump_mrvl_step(MRVL_STEP_ON);
+	bt_vendor_cbacks->scocfg_cb(result);
+}
+
+static void hw_mrvl_config_start_cb(void *p_mem);
+
+static int hw_mrvl_xmit(uint16_t cmd, uint8_t pl_len, uint8_t *payload,
+		tINT_CMD_CBACK p_cback)
+{
+	HC_BT_HDR *p_buf = build_cmd_buf(cmd, pl_len, payload);
+
+	if (!p_buf)
+		return FALSE;
+
+	ALOGI("Sending hci command 0x%04hX (%s)", cmd, cmd_to_str(cmd));
+	dump_mrvl_cmd_sent(cmd);
+	if (bt_vendor_cbacks->xmit_cb(cmd, p_buf, p_cback))
+		return TRUE;
+
+	bt_vendor_cbacks->dealloc(p_buf);
+	return FALSE;
+}
+
+static int hw_mrvl_send_bd_addr(void)
+{
+#ifdef MRVL_BOARD_BD_ADDRESS
+	ALOGI("Setting bd addr from board profile");
+#else
+	ALOGI("Setting bd addr to %02hhX:%02hhX:%02hhX:%02hhX:%02hhX:%02hhX",
+		vnd_local_bd_addr[0], vnd_local_bd_addr[1], vnd_local_bd_addr[2],
+		vnd_local_bd_addr[3], vnd_local_bd_addr[4], vnd_local_bd_addr[5]);
+	populate_bd_addr_params(write_bd_address + 2, vnd_local_bd_addr);
+#endif
+
+	return hw_mrvl_xmit(HCI_CMD_MARVELL_WRITE_BD_ADDRESS,
+			WRITE_BD_ADDRESS_SIZE, write_bd_address,
+			hw_mrvl_config_start_cb);
+}
+
+/*
+ * The verification command got no answer at the new rate. The controller
+ * has switched already and cannot be told to go back over a link that
+ * does not work, so fail FW config; the power cycle that follows brings
+ * it up at the boot rate again. A Command Complete that still turns up
+ * later finds baud_verify_pending cleared and is dropped.
+ */
+static void hw_mrvl_baud_verify_timeout(union sigval sv)
+{
+	if (!__sync_bool_compare_and_swap(&baud_verify_pending, 1, 0))
+		return;
+
+	ALOGE("No response at %u baud after %u ms, FW config failed",
+		uart_cur_baud, vnd_conf.uart_verify_ms);
+
+	/* The port is no use to a restarted stack either */
+	fd_handoff_mrvl_drop();
+	if (bt_vendor_cbacks)
+		hw_mrvl_fwcfg_done(BT_VND_OP_RESULT_FAIL);
+}
+
+static void hw_mrvl_baud_verify_arm(void)
+{
+	struct sigevent sev;
+	struct itimerspec ts;
+
+	if (!baud_verify_timer_created) {
+		memset(&sev, 0, sizeof(sev));
+		sev.sigev_notify = SIGEV_THREAD;
+		sev.sigev_notify_function = hw_mrvl_baud_verify_timeout;
+		if (timer_create(CLOCK_MONOTONIC, &sev, &baud_verify_timer) < 0) {
+			ALOGE("Fail to create baud verify timer: %s",
+				strerror(errno));
+			return;
+		}
+		baud_verify_timer_created = TRUE;
+	}
+
+	memset(&ts, 0, sizeof(ts));
+	ts.it_value.tv_sec = vnd_conf.uart_verify_ms / 1000;
+	ts.it_value.tv_nsec = (vnd_conf.uart_verify_ms % 1000) * 1000000;
+
+	baud_verify_pending = 1;
+	timer_settime(baud_verify_timer, 0, &ts, NULL);
+}
+
+static void hw_mrvl_baud_verify_disarm(void)
+{
+	struct itimerspec ts;
+
+	if (!baud_verify_timer_created)
+		return;
+
+	memset(&ts, 0, sizeof(ts));
+	timer_settime(baud_verify_timer, 0, &ts, NULL);
 }
 
 static void hw_mrvl_config_start_cb(void *p_mem)
 {
 	HC_BT_HDR *p_evt_buf = (HC_BT_HDR *) p_mem;
 	struct bt_evt_param_t evt_params;
+	uint8_t dummy = 0;
 
 	assert(p_mem);
 
+	/* The lib has been cleaned up while the chain was in flight */
+	if (!bt_vendor_cbacks) {
+		drop_evt_buf(p_evt_buf, "FW config");
+		return;
+	}
+
 	memset(&evt_params, 0, sizeof(evt_params));
 
 	parse_evt_buf(p_evt_buf, &evt_params);
 
 	/* free the buffer */
-	if (bt_vendor_cbacks)
-		bt_vendor_cbacks->dealloc(p_evt_buf);
+	bt_vendor_cbacks->dealloc(p_evt_buf);
 
 	switch (evt_params.cmd) {
+	case HCI_CMD_MARVELL_SET_UART_BAUD:
+		if (evt_params.cmd_ret_param) {
+			vnd_enable_stats.cmd_failures++;
+			ALOGW("Controller refused %u baud (status 0x%02X), "
+				"stay at %u", vnd_conf.uart_oper_baud,
+				evt_params.cmd_ret_param, uart_cur_baud);
+			if (hw_mrvl_send_bd_addr())
+				return;
+			break;
+		}
+
+		/* Controller switches once it has sent the Command Complete */
+		if (userial_mrvl_set_baud(mchar_fd, vnd_conf.uart_oper_baud) < 0)
+			break;
+		uart_cur_baud = vnd_conf.uart_oper_baud;
+
+		/* Make sure the link works at the new rate */
+		hw_mrvl_baud_verify_arm();
+		if (hw_mrvl_xmit(HCI_CMD_READ_LOCAL_VERSION, 0, &dummy,
+				hw_mrvl_config_start_cb))
+			return;
+		hw_mrvl_baud_verify_disarm();
+		/* Unless the timer has failed FW config already */
+		if (!__sync_bool_compare_and_swap(&baud_verify_pending, 1, 0))
+			return;
+		break;
+
+	case HCI_CMD_READ_LOCAL_VERSION:
+		hw_mrvl_baud_verify_disarm();
+		if (!__sync_bool_compare_and_swap(&baud_verify_pending, 1, 0)) {
+			ALOGW("UART verify answered after the timeout, ignored");
+			return;
+		}
+		ALOGI("UART running at %u baud (switch took %u ms)",
+			uart_cur_baud, ms_since(&baud_switch_start));
+		if (hw_mrvl_send_bd_addr())
+			return;
+		break;
+
 	case HCI_CMD_MARVELL_WRITE_BD_ADDRESS:
 		/* fw config succeeds */
 		ALOGI("FW config succeeds!");
-		if (bt_vendor_cbacks)
-			bt_vendor_cbacks->fwcfg_cb(BT_VND_OP_RESULT_SUCCESS);
+		hw_mrvl_fwcfg_done(BT_VND_OP_RESULT_SUCCESS);
 		return;
 
 	default:
@@ -236,10 +628,8 @@ static void hw_mrvl_config_start_cb(void *p_mem)
 		break;
 	} /* end of switch (evt_params.cmd) */
 
-	if (bt_vendor_cbacks) {
-		ALOGE("Vendor lib fwcfg aborted");
-		bt_vendor_cbacks->fwcfg_cb(BT_VND_OP_RESULT_FAIL);
-	}
+	ALOGE("Vendor lib fwcfg aborted");
+	hw_mrvl_fwcfg_done(BT_VND_OP_RESULT_FAIL);
 }
 
 static void hw_mrvl_sco_config_cb(void *p_mem)
@@ -249,7 +639,13 @@ static void hw_mrvl_sco_config_cb(void *p_mem)
 	uint16_t cmd = 0;
 	HC_BT_HDR *p_buf = NULL;
 
-	assert(bt_vendor_cbacks && p_mem);
+	assert(p_mem);
+
+	/* The lib has been cleaned up while the chain was in flight */
+	if (!bt_vendor_cbacks) {
+		drop_evt_buf(p_evt_buf, "SCO config");
+		return;
+	}
 
 	memset(&evt_params, 0, sizeof(evt_params));
 
@@ -285,9 +681,21 @@ static void hw_mrvl_sco_config_cb(void *p_mem)
 
 	case HCI_CMD_MARVELL_SET_SCO_DATA_PATH:
 		/* sco config succeeds */
-		ALOGI("SCO PCM config succeeds!");
-		if (bt_vendor_cbacks)
-			bt_vendor_cbacks->scocfg_cb(BT_VND_OP_RESULT_SUCCESS);
+		ALOGI("SCO %s config succeeds!",
+			vnd_conf.sco_data_path == MRVL_SCO_PATH_HCI ?
+			"HCI" : "PCM");
+		if (vnd_conf.sco_data_path == MRVL_SCO_PATH_PCM) {
+			memcpy(applied_pcm_settings, write_pcm_settings,
+				WRITE_PCM_SETTINGS_SIZE);
+			memcpy(applied_pcm_sync_settings,
+				write_pcm_sync_settings,
+				WRITE_PCM_SYNC_SETTINGS_SIZE);
+			memcpy(applied_pcm_link_settings,
+				write_pcm_link_settings,
+				WRITE_PCM_LINK_SETTINGS_SIZE);
+			pcm_applied = TRUE;
+		}
+		hw_mrvl_scocfg_done(BT_VND_OP_RESULT_SUCCESS);
 		return;
 
 	default:
@@ -298,6 +706,7 @@ static void hw_mrvl_sco_config_cb(void *p_mem)
 
 	if (p_buf) {
 		ALOGI("Sending hci command 0x%04hX (%s)", cmd, cmd_to_str(cmd));
+		dump_mrvl_cmd_sent(cmd);
 		if (bt_vendor_cbacks->xmit_cb(cmd, p_buf, hw_mrvl_sco_config_cb))
 			return;
 		else
@@ -305,7 +714,276 @@ static void hw_mrvl_sco_config_cb(void *p_mem)
 	}
 
 	ALOGE("Vendor lib scocfg aborted");
-	bt_vendor_cbacks->scocfg_cb(BT_VND_OP_RESULT_FAIL);
+	hw_mrvl_scocfg_done(BT_VND_OP_RESULT_FAIL);
+}
+
+/*
+ * Resend the PCM commands whose payload differs from what the controller
+ * holds, in chain order. Each completion moves on to the next one.
+ */
+static void hw_mrvl_pcm_update_cb(void *p_mem);
+
+static int hw_mrvl_pcm_update_next(uint16_t after)
+{
+	switch (after) {
+	case 0:
+		if (memcmp(applied_pcm_settings, write_pcm_settings,
+				WRITE_PCM_SETTINGS_SIZE))
+			return hw_mrvl_xmit(HCI_CMD_MARVELL_WRITE_PCM_SETTINGS,
+					WRITE_PCM_SETTINGS_SIZE,
+					write_pcm_settings,
+					hw_mrvl_pcm_update_cb);
+		/* fall through */
+	case HCI_CMD_MARVELL_WRITE_PCM_SETTINGS:
+		if (memcmp(applied_pcm_sync_settings, write_pcm_sync_settings,
+				WRITE_PCM_SYNC_SETTINGS_SIZE))
+			return hw_mrvl_xmit(
+					HCI_CMD_MARVELL_WRITE_PCM_SYNC_SETTINGS,
+					WRITE_PCM_SYNC_SETTINGS_SIZE,
+					write_pcm_sync_settings,
+					hw_mrvl_pcm_update_cb);
+		/* fall through */
+	case HCI_CMD_MARVELL_WRITE_PCM_SYNC_SETTINGS:
+		if (memcmp(applied_pcm_link_settings, write_pcm_link_settings,
+				WRITE_PCM_LINK_SETTINGS_SIZE))
+			return hw_mrvl_xmit(
+					HCI_CMD_MARVELL_WRITE_PCM_LINK_SETTINGS,
+					WRITE_PCM_LINK_SETTINGS_SIZE,
+					write_pcm_link_settings,
+					hw_mrvl_pcm_update_cb);
+		/* fall through */
+	default:
+		break;
+	}
+
+	ALOGI("PCM profile %s applied", pcm_profile->name);
+	dump_mrvl_step(MRVL_STEP_ON);
+	return TRUE;
+}
+
+static void hw_mrvl_pcm_update_cb(void *p_mem)
+{
+	HC_BT_HDR *p_evt_buf = (HC_BT_HDR *) p_mem;
+	struct bt_evt_param_t evt_params;
+
+	assert(p_mem);
+
+	if (!bt_vendor_cbacks) {
+		drop_evt_buf(p_evt_buf, "PCM profile");
+		return;
+	}
+
+	memset(&evt_params, 0, sizeof(evt_params));
+	parse_evt_buf(p_evt_buf, &evt_params);
+	bt_vendor_cbacks->dealloc(p_evt_buf);
+
+	if (evt_params.cmd_ret_param) {
+		ALOGE("PCM profile update: %s failed (0x%02X)",
+			cmd_to_str(evt_params.cmd), evt_params.cmd_ret_param);
+		return;
+	}
+
+	switch (evt_params.cmd) {
+	case HCI_CMD_MARVELL_WRITE_PCM_SETTINGS:
+		memcpy(applied_pcm_settings, write_pcm_settings,
+			WRITE_PCM_SETTINGS_SIZE);
+		break;
+	case HCI_CMD_MARVELL_WRITE_PCM_SYNC_SETTINGS:
+		memcpy(applied_pcm_sync_settings, write_pcm_sync_settings,
+			WRITE_PCM_SYNC_SETTINGS_SIZE);
+		break;
+	case HCI_CMD_MARVELL_WRITE_PCM_LINK_SETTINGS:
+		memcpy(applied_pcm_link_settings, write_pcm_link_settings,
+			WRITE_PCM_LINK_SETTINGS_SIZE);
+		break;
+	default:
+		ALOGE("PCM profile update: unexpected cmd (0x%04hX)",
+			evt_params.cmd);
+		return;
+	}
+
+	if (!hw_mrvl_pcm_update_next(evt_params.cmd))
+		ALOGE("PCM profile update aborted");
+}
+
+/* Runtime link profile switch, one standard HCI command per step */
+static int link_cmd_idx;
+
+static void hw_mrvl_link_profile_cb(void *p_mem);
+
+static int hw_mrvl_link_profile_next(void)
+{
+	uint8_t param[HCI_CFG_MAX_PARAM];
+	uint16_t cmd;
+	int len;
+
+	len = hci_cfg_mrvl_link_cmd(link_cmd_idx, &cmd, param);
+	if (len < 0) {
+		ALOGI("Link profile applied");
+		dump_mrvl_step(MRVL_STEP_ON);
+		return TRUE;
+	}
+
+	link_cmd_idx++;
+	return hw_mrvl_xmit(cmd, (uint8_t) len, param, hw_mrvl_link_profile_cb);
+}
+
+static void hw_mrvl_link_profile_cb(void *p_mem)
+{
+	HC_BT_HDR *p_evt_buf = (HC_BT_HDR *) p_mem;
+	struct bt_evt_param_t evt_params;
+
+	assert(p_mem);
+
+	if (!bt_vendor_cbacks) {
+		drop_evt_buf(p_evt_buf, "link profile");
+		return;
+	}
+
+	memset(&evt_params, 0, sizeof(evt_params));
+	parse_evt_buf(p_evt_buf, &evt_params);
+	bt_vendor_cbacks->dealloc(p_evt_buf);
+
+	if (evt_params.cmd_ret_param)
+		ALOGW("Link profile: cmd 0x%04hX failed (0x%02X)",
+			evt_params.cmd, evt_params.cmd_ret_param);
+
+	if (!hw_mrvl_link_profile_next())
+		ALOGE("Link profile update aborted");
+}
+
+/*
+ * The daemon may be busy with WLAN on the shared chip; retry a few times
+ * quickly rather than let the stack find out at the USERIAL_OPEN timeout.
+ */
+static int hw_mrvl_power_on(void)
+{
+	const struct mrvl_rt_conf *rt = vnd_rt_conf_get();
+	uint32_t backoff = rt->power_on_backoff_ms;
+	uint32_t tries;
+	int err = -1;
+
+	for (tries = 1; tries <= rt->power_on_tries; tries++) {
+		err = bluetooth_enable();
+		if (!err)
+			break;
+		ALOGW("bluetooth_enable failed (%d), try %u/%u", err, tries,
+			rt->power_on_tries);
+		if (tries < rt->power_on_tries) {
+			usleep(backoff * 1000);
+			backoff *= 2;
+		}
+	}
+
+	if (err) {
+		power_on_failed++;
+	} else if (tries > 1) {
+		power_on_retried++;
+	} else {
+		power_on_ok++;
+	}
+
+	ALOGD("Power on %s: ok %u, ok after retry %u, failed %u",
+		err ? "failed" : "done", power_on_ok, power_on_retried,
+		power_on_failed);
+
+	return err ? -1 : 0;
+}
+
+static int userial_close_port(void)
+{
+	int local_st = 0;
+	int ret = 0;
+
+	if (mchar_fd < 0)
+		return -1;
+
+	/* A firmware dump in progress still needs the controller */
+	fw_dump_mrvl_wait();
+	transport_mrvl_stop();
+	ll_link_mrvl_reset();
+	/* A chain cut off by the close never calls back */
+	ll_busy = FALSE;
+	fd_handoff_mrvl_drop();
+	handoff_warm = FALSE;
+
+	if (vnd_conf.transport == MRVL_TRANSPORT_UART) {
+		/* Drop whatever the controller still has in flight */
+		tcflush(mchar_fd, TCIOFLUSH);
+	} else {
+		/* mbtchar port is blocked on read. Release the port
+		 * before we close it.
+		 */
+		ioctl(mchar_fd, MBTCHAR_IOCTL_RELEASE, &local_st);
+		/* Give it sometime before we close the mbtchar */
+		usleep(1000);
+	}
+	ALOGD("close port %s", port_name());
+	if (close(mchar_fd) < 0) {
+		ALOGE("Fail to close port %s", port_name());
+		ret = -1;
+	}
+	mchar_fd = -1;
+
+	return ret;
+}
+
+/*
+ * The node may show up before the firmware answers; make sure it does
+ * before FW config starts, so the first vendor command cannot stall.
+ */
+static int hw_mrvl_probe_port(void)
+{
+	if (mchar_fd < 0 || !vnd_conf.ready_probe)
+		return mchar_fd;
+
+	if (userial_mrvl_probe(mchar_fd, vnd_conf.ready_probe_timeout_ms,
+			vnd_conf.ready_probe_budget_ms,
+			&vnd_enable_stats.probe_attempts,
+			&vnd_enable_stats.probe_ms) < 0)
+		userial_close_port();
+
+	return mchar_fd;
+}
+
+static int userial_open_port(void)
+{
+	int retry = vnd_rt_conf_get()->open_deadline_ms / MRVL_OPEN_POLL_MS;
+
+	if (handoff_fd >= 0) {
+		/* Same controller the previous process configured */
+		mchar_fd = handoff_fd;
+		handoff_fd = -1;
+		handoff_warm = TRUE;
+		return mchar_fd;
+	}
+
+	if (vnd_conf.transport == MRVL_TRANSPORT_UART) {
+		mchar_fd = userial_mrvl_open_uart(vnd_conf.uart_port,
+				vnd_conf.uart_baud, vnd_conf.uart_flow_ctl);
+		uart_cur_baud = vnd_conf.uart_baud;
+		if (mchar_fd >= 0 && fw_loader_mrvl_download(mchar_fd) < 0) {
+			ALOGE("Fail to download firmware to %s", port_name());
+			close(mchar_fd);
+			mchar_fd = -1;
+		}
+		return hw_mrvl_probe_port();
+	}
+
+	/* mbtchar node shows up once the driver has loaded the firmware */
+	do {
+		mchar_fd = open(vnd_conf.mchar_port, O_RDWR|O_NOCTTY);
+		if(mchar_fd < 0)
+			usleep(MRVL_OPEN_POLL_MS * 1000);
+		else
+			break;
+		vnd_enable_stats.open_retries++;
+		retry--;
+		if(retry <= 0)
+			break;
+	}while(1);
+
+	return hw_mrvl_probe_port();
 }
 
 /***********************************************************
@@ -314,33 +992,32 @@ static void hw_mrvl_sco_config_cb(void *p_mem)
  */
 void hw_mrvl_config_start(void)
 {
-	HC_BT_HDR *p_buf = NULL;
-	uint16_t cmd = 0;
+	uint32_t baud = vnd_conf.uart_oper_baud;
 
 	assert(bt_vendor_cbacks);
 
 	ALOGI("Start HW config ...");
-	/* Start with HCI_CMD_MARVELL_WRITE_BD_ADDRESS */
-	ALOGI("Setting bd addr to %02hhX:%02hhX:%02hhX:%02hhX:%02hhX:%02hhX",
-		vnd_local_bd_addr[0], vnd_local_bd_addr[1], vnd_local_bd_addr[2],
-		vnd_local_bd_addr[3], vnd_local_bd_addr[4], vnd_local_bd_addr[5]);
-	populate_bd_addr_params(write_bd_address + 2, vnd_local_bd_addr);
 
-	cmd   = HCI_CMD_MARVELL_WRITE_BD_ADDRESS;
-	p_buf = build_cmd_buf(cmd,
-			WRITE_BD_ADDRESS_SIZE,
-			write_bd_address);
-
-	if (p_buf) {
-		ALOGI("Sending hci command 0x%04hX (%s)", cmd, cmd_to_str(cmd));
-		if (bt_vendor_cbacks->xmit_cb(cmd, p_buf, hw_mrvl_config_start_cb))
+	/* UART controllers boot slow; move to the operational rate first */
+	if (vnd_conf.transport == MRVL_TRANSPORT_UART && baud &&
+			baud != uart_cur_baud) {
+		ALOGI("Switching UART from %u to %u baud", uart_cur_baud, baud);
+		clock_gettime(CLOCK_MONOTONIC, &baud_switch_start);
+		set_uart_baud[0] = (uint8_t) baud;
+		set_uart_baud[1] = (uint8_t) (baud >> 8);
+		set_uart_baud[2] = (uint8_t) (baud >> 16);
+		set_uart_baud[3] = (uint8_t) (baud >> 24);
+		if (hw_mrvl_xmit(HCI_CMD_MARVELL_SET_UART_BAUD,
+				SET_UART_BAUD_SIZE, set_uart_baud,
+				hw_mrvl_config_start_cb))
 			return;
-		else
-			bt_vendor_cbacks->dealloc(p_buf);
+	} else if (hw_mrvl_send_bd_addr()) {
+		/* Start with HCI_CMD_MARVELL_WRITE_BD_ADDRESS */
+		return;
 	}
 
 	ALOGE("Vendor lib fwcfg aborted");
-	bt_vendor_cbacks->fwcfg_cb(BT_VND_OP_RESULT_FAIL);
+	hw_mrvl_fwcfg_done(BT_VND_OP_RESULT_FAIL);
 }
 
 
@@ -352,14 +1029,27 @@ void hw_mrvl_sco_config(void)
 	assert(bt_vendor_cbacks);
 
 	ALOGI("Start SCO config ...");
-	/* Start with HCI_CMD_MARVELL_WRITE_PCM_SETTINGS */
-	cmd   = HCI_CMD_MARVELL_WRITE_PCM_SETTINGS;
-	p_buf = build_cmd_buf(cmd,
-			WRITE_PCM_SETTINGS_SIZE,
-			write_pcm_settings);
+	dump_mrvl_step(MRVL_STEP_SCO_CFG);
+	pm_qos_mrvl_acquire(PM_QOS_SCO_CFG);
+	set_sco_data_path[0] = (uint8_t) vnd_conf.sco_data_path;
+	pcm_profile_encode(pcm_profile);
+	if (vnd_conf.sco_data_path == MRVL_SCO_PATH_HCI) {
+		/* No PCM codec on the other end, only route SCO over HCI */
+		cmd   = HCI_CMD_MARVELL_SET_SCO_DATA_PATH;
+		p_buf = build_cmd_buf(cmd,
+				SET_SCO_DATA_PATH_SIZE,
+				set_sco_data_path);
+	} else {
+		/* Start with HCI_CMD_MARVELL_WRITE_PCM_SETTINGS */
+		cmd   = HCI_CMD_MARVELL_WRITE_PCM_SETTINGS;
+		p_buf = build_cmd_buf(cmd,
+				WRITE_PCM_SETTINGS_SIZE,
+				write_pcm_settings);
+	}
 
 	if (p_buf) {
 		ALOGI("Sending hci command 0x%04hX (%s)", cmd, cmd_to_str(cmd));
+		dump_mrvl_cmd_sent(cmd);
 		if (bt_vendor_cbacks->xmit_cb(cmd, p_buf, hw_mrvl_sco_config_cb))
 			return;
 		else
@@ -367,14 +1057,249 @@ void hw_mrvl_sco_config(void)
 	}
 
 	ALOGE("Vendor lib scocfg aborted");
-	bt_vendor_cbacks->scocfg_cb(BT_VND_OP_RESULT_FAIL);
+	hw_mrvl_scocfg_done(BT_VND_OP_RESULT_FAIL);
+}
+
+/*
+ * Select the PCM profile by name. If SCO has already been configured, the
+ * PCM commands whose payload changes are resent right away; otherwise the
+ * profile is picked up by the next SCO config. Called at init for
+ * PcmProfile and later through BT_VND_OP_MRVL_SET_PCM_PROFILE.
+ */
+int hw_mrvl_set_pcm_profile(const char *name)
+{
+#ifdef MRVL_BOARD_PROFILE
+	ALOGW("PCM settings fixed by board profile, ignoring %s", name);
+	return -1;
+#else
+	const struct pcm_profile *prof = pcm_profile_find(name);
+
+	if (!prof) {
+		ALOGE("Unknown PCM profile %s", name);
+		return -1;
+	}
+
+	ALOGI("Select PCM profile %s", prof->name);
+	pcm_profile = prof;
+	pcm_profile_encode(prof);
+
+	if (!pcm_applied || !bt_vendor_cbacks ||
+			vnd_conf.sco_data_path != MRVL_SCO_PATH_PCM)
+		return 0;
+
+	dump_mrvl_step(MRVL_STEP_PCM_UPDATE);
+	return hw_mrvl_pcm_update_next(0) ? 0 : -1;
+#endif
+}
+
+/*
+ * Name of the idx-th built-in PCM profile, NULL past the last one; lets
+ * tools walk the table without knowing its size.
+ */
+const char *hw_mrvl_pcm_profile_name(unsigned int idx)
+{
+	if (idx >= sizeof(pcm_profiles) / sizeof(pcm_profiles[0]))
+		return NULL;
+	return pcm_profiles[idx].name;
+}
+
+/*
+ * Select the classic link profile. With the port open the profile's
+ * commands are sent right away; otherwise they go out after the next
+ * controller reset. Going back to "default" takes effect at the next
+ * reset, as only a reset restores the controller defaults. Called at
+ * run time through BT_VND_OP_MRVL_SET_LINK_PROFILE.
+ */
+int hw_mrvl_set_link_profile(const char *name)
+{
+	if (hci_cfg_mrvl_set_link_profile(name) < 0)
+		return -1;
+
+	if (!bt_vendor_cbacks || mchar_fd < 0)
+		return 0;
+
+	link_cmd_idx = 0;
+	dump_mrvl_step(MRVL_STEP_LINK_PROFILE);
+	return hw_mrvl_link_profile_next() ? 0 : -1;
+}
+
+/*
+ * Low latency link: keep the link active (no sniff, hold or park) and ask
+ * for guaranteed service, which makes the master poll the device every
+ * LowLatencyPollUs. Read the link policy first so it can be put back.
+ */
+static uint16_t ll_handle;
+static uint16_t ll_policy;
+static int ll_enable;
+
+static void hw_mrvl_ll_cb(void *p_mem);
+
+static int hw_mrvl_ll_write_policy(uint16_t policy)
+{
+	uint8_t param[WRITE_LINK_POLICY_SIZE];
+
+	param[0] = (uint8_t) ll_handle;
+	param[1] = (uint8_t) (ll_handle >> 8);
+	param[2] = (uint8_t) policy;
+	param[3] = (uint8_t) (policy >> 8);
+	return hw_mrvl_xmit(HCI_CMD_WRITE_LINK_POLICY, WRITE_LINK_POLICY_SIZE,
+			param, hw_mrvl_ll_cb);
+}
+
+static int hw_mrvl_ll_qos(void)
+{
+	uint8_t param[QOS_SETUP_SIZE];
+	uint32_t latency = ll_enable ? vnd_conf.ll_poll_us : 0xFFFFFFFF;
+
+	memset(param, 0, sizeof(param));
+	param[0] = (uint8_t) ll_handle;
+	param[1] = (uint8_t) (ll_handle >> 8);
+	param[3] = ll_enable ? QOS_GUARANTEED : QOS_BEST_EFFORT;
+	/* token rate and peak bandwidth: no preference */
+	param[12] = (uint8_t) latency;
+	param[13] = (uint8_t) (latency >> 8);
+	param[14] = (uint8_t) (latency >> 16);
+	param[15] = (uint8_t) (latency >> 24);
+	memset(param + 16, 0xFF, 4);  /* delay variation: don't care */
+	return hw_mrvl_xmit(HCI_CMD_QOS_SETUP, QOS_SETUP_SIZE, param,
+			hw_mrvl_ll_cb);
+}
+
+static void hw_mrvl_ll_cb(void *p_mem)
+{
+	HC_BT_HDR *p_evt_buf = (HC_BT_HDR *) p_mem;
+	struct bt_evt_param_t evt_params;
+	uint8_t *p = (uint8_t *) (p_evt_buf + 1);
+	int ok = FALSE;
+
+	assert(p_mem);
+
+	if (!bt_vendor_cbacks) {
+		drop_evt_buf(p_evt_buf, "low latency");
+		ll_busy = FALSE;
+		return;
+	}
+
+	memset(&evt_params, 0, sizeof(evt_params));
+	parse_evt_buf(p_evt_buf, &evt_params);
+
+	if (evt_params.cmd_ret_param) {
+		ALOGW("Low latency 0x%03X: %s failed (0x%02X)", ll_handle,
+			cmd_to_str(evt_params.cmd), evt_params.cmd_ret_param);
+	} else {
+		switch (evt_params.cmd) {
+		case HCI_CMD_READ_LINK_POLICY:
+			/* status, handle, policy */
+			ll_policy = p[HCI_EVT_CMD_CMPL_OPCODE + 5] |
+				(p[HCI_EVT_CMD_CMPL_OPCODE + 6] << 8);
+			ok = hw_mrvl_ll_write_policy(ll_policy &
+				~LINK_POLICY_LOW_POWER);
+			break;
+		case HCI_CMD_WRITE_LINK_POLICY:
+			ok = hw_mrvl_ll_qos();
+			break;
+		case HCI_CMD_QOS_SETUP:
+			/* Untracked only once the link is fully restored */
+			if (!ll_enable)
+				ll_link_mrvl_remove(ll_handle, "restored");
+			else if (ll_link_mrvl_add(ll_handle, ll_policy) < 0)
+				ALOGW("Low latency 0x%03X: not tracked, "
+					"table full", ll_handle);
+			ALOGI("Low latency %s for 0x%03X",
+				ll_enable ? "on" : "off", ll_handle);
+			break;
+		default:
+			break;
+		}
+	}
+	bt_vendor_cbacks->dealloc(p_evt_buf);
+
+	if (!ok)
+		ll_busy = FALSE;
+}
+
+/*
+ * Put one ACL connection in or out of low latency mode. Going back
+ * restores the link policy the link had before. A disconnect needs
+ * nothing: the controller drops these settings with the link. Called
+ * through BT_VND_OP_MRVL_SET_LOW_LATENCY.
+ */
+int hw_mrvl_set_low_latency(uint16_t handle, int enable)
+{
+	uint8_t param[2];
+	int policy;
+
+	if (!bt_vendor_cbacks || mchar_fd < 0)
+		return -1;
+	if (__sync_lock_test_and_set(&ll_busy, TRUE)) {
+		ALOGW("Low latency change already in progress");
+		return -1;
+	}
+
+	ll_handle = handle & 0x0FFF;
+	ll_enable = enable;
+	if (enable) {
+		param[0] = (uint8_t) ll_handle;
+		param[1] = (uint8_t) (ll_handle >> 8);
+		if (hw_mrvl_xmit(HCI_CMD_READ_LINK_POLICY, sizeof(param),
+				param, hw_mrvl_ll_cb))
+			return 0;
+	} else {
+		/* Tracked until the restore is through; a failure can retry */
+		policy = ll_link_mrvl_policy(ll_handle);
+		if (policy < 0) {
+			ll_busy = FALSE;
+			return 0;
+		}
+		if (hw_mrvl_ll_write_policy((uint16_t) policy))
+			return 0;
+	}
+
+	ll_busy = FALSE;
+	return -1;
+}
+
+/*
+ * Called from the relay when the firmware reports a fault. The stack
+ * sees the event too and will restart us; make sure that restart power
+ * cycles the controller instead of picking up the handed over port.
+ */
+void hw_mrvl_controller_fault(uint8_t code)
+{
+	ALOGE("controller fault 0x%02X, forcing cold start next enable", code);
+	fd_handoff_mrvl_drop();
+	handoff_warm = FALSE;
+	fw_dump_mrvl_start(code);
+}
+
+/* Called from the dump thread; plain reads of counters are enough */
+void hw_mrvl_dump_state(void)
+{
+	ALOGI("dump: port %s fd %d%s, power on ok %u retried %u failed %u, "
+		"power off failed %u", port_name(), mchar_fd,
+		handoff_warm ? " (handed over)" : "", power_on_ok,
+		power_on_retried, power_on_failed, power_off_failed);
+	fw_dump_mrvl_dump_stats();
 }
 
 int bt_vnd_mrvl_if_init(const bt_vendor_callbacks_t *p_cb,
 		unsigned char *local_bdaddr)
 {
 	ALOGI("Marvell BT Vendor Lib: ver %s", VERSION);
+	vnd_load_conf(VENDOR_LIB_CONF_FILE);
+#ifdef MRVL_BOARD_PROFILE
+	vnd_conf.sco_data_path = MRVL_BOARD_SCO_DATA_PATH;
+#endif
+	if (vnd_conf.conf_hot_reload)
+		vnd_conf_watch_start(VENDOR_LIB_CONF_FILE);
+	if (vnd_conf.dump_signal)
+		dump_mrvl_start((int) vnd_conf.dump_signal);
+	if (vnd_conf.pcm_profile[0])
+		hw_mrvl_set_pcm_profile(vnd_conf.pcm_profile);
+	if (vnd_conf.link_profile[0])
+		hci_cfg_mrvl_set_link_profile(vnd_conf.link_profile);
 	bt_vendor_cbacks = (bt_vendor_callbacks_t *) p_cb;
+	evt_dealloc = p_cb->dealloc;
 	memcpy(vnd_local_bd_addr, local_bdaddr, sizeof(vnd_local_bd_addr));
 	return 0;
 }
@@ -383,67 +1308,104 @@ int bt_vnd_mrvl_if_op(bt_vendor_opcode_t opcode, void *param)
 {
 	int ret = 0;
 	int *power_state = NULL;
-	int local_st = 0;
-	int retry=20;
+	const struct mrvl_low_latency_param *ll_param;
 
 	//ALOGD("opcode = %d", opcode);
-	switch (opcode) {
+	switch ((int) opcode) {
 	case BT_VND_OP_POWER_CTRL:
 		power_state = (int *)param;
+		if (vnd_conf.fd_handoff && mchar_fd < 0 && handoff_fd < 0)
+			handoff_fd = fd_handoff_mrvl_get();
+		if (handoff_fd >= 0) {
+			/* A power cycle would throw the configured state away */
+			ALOGD("Skip power %s, controller handed over",
+				*power_state == BT_VND_PWR_ON ? "on" : "off");
+			if (BT_VND_PWR_ON == *power_state) {
+				memset(&vnd_enable_stats, 0,
+					sizeof(vnd_enable_stats));
+				clock_gettime(CLOCK_MONOTONIC, &enable_start);
+				enable_cpu_start_ms = cpu_now_ms();
+			}
+			break;
+		}
 		if (BT_VND_PWR_OFF == *power_state) {
 			ALOGD("Power off");
-			bluetooth_disable();
+			dump_mrvl_step(MRVL_STEP_OFF);
+			pm_qos_mrvl_release(PM_QOS_ENABLE);
+			fw_dump_mrvl_wait();
+			if (bluetooth_disable()) {
+				power_off_failed++;
+				ALOGE("bluetooth_disable failed (%u so far)",
+					power_off_failed);
+				ret = -1;
+			}
 		} else if (BT_VND_PWR_ON == *power_state) {
 			ALOGD("Power on");
-			bluetooth_enable();
+			dump_mrvl_step(MRVL_STEP_POWER_ON);
+			memset(&vnd_enable_stats, 0, sizeof(vnd_enable_stats));
+			clock_gettime(CLOCK_MONOTONIC, &enable_start);
+			enable_cpu_start_ms = cpu_now_ms();
+			/* Keep Command Complete wake-ups out of deep idle */
+			pm_qos_mrvl_acquire(PM_QOS_ENABLE);
+			ret = hw_mrvl_power_on();
+			vnd_enable_stats.power_ms = ms_since(&enable_start);
+			if (ret)
+				hw_mrvl_enable_done(BT_VND_OP_RESULT_FAIL);
 		} else {
 			ret = -1;
 		}
 		break;
 	case BT_VND_OP_FW_CFG:
+		clock_gettime(CLOCK_MONOTONIC, &phase_start);
+		dump_mrvl_step(MRVL_STEP_FW_CFG);
+		if (handoff_warm) {
+			ALOGI("Controller configured by previous instance");
+			if (bt_vendor_cbacks)
+				hw_mrvl_fwcfg_done(BT_VND_OP_RESULT_SUCCESS);
+			break;
+		}
 		hw_mrvl_config_start();
 		break;
 	case BT_VND_OP_SCO_CFG:
 		hw_mrvl_sco_config();
 		break;
 	case BT_VND_OP_USERIAL_OPEN:
-		do {
-			mchar_fd = open(mchar_port, O_RDWR|O_NOCTTY);
-			if(mchar_fd < 0)
-				usleep(200000);
-			else
-				break;
-			retry--;
-			if(!retry)
-				break;
-		}while(1);
-		if (mchar_fd < 0) {
-			ALOGE("Fail to open port %s", mchar_port);
+		/* A port left open by a previous session keeps the node busy */
+		if (mchar_fd >= 0) {
+			ALOGW("port %s still open, closing it first", port_name());
+			userial_close_port();
+		}
+		clock_gettime(CLOCK_MONOTONIC, &phase_start);
+		dump_mrvl_step(MRVL_STEP_OPEN);
+		vnd_enable_stats.open_retries = 0;
+		if (userial_open_port() < 0) {
+			ALOGE("Fail to open port %s", port_name());
+			vnd_enable_stats.open_ms = ms_since(&phase_start);
+			hw_mrvl_enable_done(BT_VND_OP_RESULT_FAIL);
 			ret = -1;
 		} else {
-			ALOGD("open port %s success", mchar_port);
+			ALOGD("open port %s success", port_name());
+			if (!handoff_warm)
+				fd_handoff_mrvl_put(mchar_fd);
 			ret = 1;
 		}
+		vnd_enable_stats.open_ms = ms_since(&phase_start);
 		((int *)param)[0] = mchar_fd;
-		break;
-	case BT_VND_OP_USERIAL_CLOSE:
-		if (mchar_fd < 0) {
-			ret = -1;
-		} else {
-			/* mbtchar port is blocked on read. Release the port
-			 * before we close it.
-			 */
-			ioctl(mchar_fd, MBTCHAR_IOCTL_RELEASE, &local_st);
-			/* Give it sometime before we close the mbtchar */
-			usleep(1000);
-			ALOGD("close port %s", mchar_port);
-			if (close(mchar_fd) < 0) {
-				ALOGE("Fail to close port %s", mchar_port);
+		/* Hand the stack a relay instead when packets need a look */
+		if (mchar_fd >= 0 && transport_mrvl_needed()) {
+			((int *)param)[0] = transport_mrvl_start(mchar_fd);
+			if (((int *)param)[0] < 0) {
+				userial_close_port();
 				ret = -1;
 			}
 		}
 		break;
+	case BT_VND_OP_USERIAL_CLOSE:
+		ret = userial_close_port();
+		break;
 	case BT_VND_OP_GET_LPM_IDLE_TIMEOUT:
+		/* Read by the stack when LPM starts, a reload applies then */
+		*(uint32_t *)param = vnd_rt_conf_get()->lpm_idle_timeout_ms;
 		break;
 	case BT_VND_OP_LPM_SET_MODE:
 		/* TODO: Enable or disable LPM mode on BT Controller.
@@ -454,6 +1416,20 @@ int bt_vnd_mrvl_if_op(bt_vendor_opcode_t opcode, void *param)
 
 		break;
 	case BT_VND_OP_LPM_WAKE_SET_STATE:
+		if (param)
+			vendor_evt_mrvl_host_wake(
+				*(uint8_t *)param == BT_VND_LPM_WAKE_ASSERT);
+		break;
+	case BT_VND_OP_MRVL_SET_PCM_PROFILE:
+		ret = param ? hw_mrvl_set_pcm_profile((const char *)param) : -1;
+		break;
+	case BT_VND_OP_MRVL_SET_LINK_PROFILE:
+		ret = param ? hw_mrvl_set_link_profile((const char *)param) : -1;
+		break;
+	case BT_VND_OP_MRVL_SET_LOW_LATENCY:
+		ll_param = (const struct mrvl_low_latency_param *)param;
+		ret = ll_param ? hw_mrvl_set_low_latency(ll_param->handle,
+				ll_param->enable) : -1;
 		break;
 	default:
 		ret = -1;
@@ -465,6 +1441,36 @@ int bt_vnd_mrvl_if_op(bt_vendor_opcode_t opcode, void *param)
 
 void bt_vnd_mrvl_if_cleanup(void)
 {
-	return;
+	ALOGI("Marvell BT Vendor Lib: cleanup");
+
+	if (baud_verify_timer_created) {
+		timer_delete(baud_verify_timer);
+		baud_verify_timer_created = FALSE;
+	}
+	baud_verify_pending = 0;
+
+	/* Any command chain still in flight sees NULL callbacks and stops */
+	bt_vendor_cbacks = NULL;
+	ll_busy = FALSE;
+
+	pm_qos_mrvl_release(PM_QOS_ENABLE | PM_QOS_SCO_CFG | PM_QOS_SCO_LINK);
+
+	/* The lib may be unloaded after this, the dump thread must be gone */
+	fw_dump_mrvl_wait();
+	if (mchar_fd >= 0)
+		userial_close_port();
+	if (handoff_fd >= 0) {
+		close(handoff_fd);
+		handoff_fd = -1;
+	}
+
+	dump_mrvl_stop();
+	journal_mrvl_stop();
+	/* Last: every thread above logs through the rt_conf snapshots */
+	vnd_conf_watch_stop();
+
+	pcm_applied = FALSE;
+	memset(vnd_local_bd_addr, 0, sizeof(vnd_local_bd_addr));
+	memset(write_bd_address + 2, 0, WRITE_BD_ADDRESS_SIZE - 2);
 }
 
@@ -0,0 +1,280 @@
+/******************************************************************************
+ *
+ *  Copyright (C) 2012 Marvell International Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at:
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+/******************************************************************************
+ *
+ *  Filename:      hci_cfg_mrvl.c
+ *
+ *  Description:   Controller defaults applied right after the stack's
+ *                 HCI_Reset. A reset wipes standard HCI settings, so they
+ *                 cannot be part of the FW config chain; the relay holds
+ *                 the reset's Command Complete, runs this sequence and
+ *                 only then lets the stack carry on.
+ *
+ ******************************************************************************/
+
+#define LOG_TAG "bt_mrvl"
+
+#include <utils/Log.h>
+#include <string.h>
+
+#include "bt_vendor_mrvl.h"
+
+#define HCI_WRITE_DEF_LINK_POLICY       0x080F
+#define HCI_WRITE_PAGE_SCAN_ACTIVITY    0x0C1C
+#define HCI_LE_READ_LOCAL_FEATURES      0x2003
+#define HCI_LE_WRITE_SUGG_DEF_DATA_LEN  0x2024
+#define HCI_LE_SET_DEFAULT_PHY          0x2031
+
+/* LE feature bits, Core spec Vol 6 Part B 4.6 */
+#define LE_FEAT_DATA_LEN_EXT            5
+#define LE_FEAT_2M_PHY                  8
+#define LE_FEAT_CODED_PHY               11
+
+#define LE_PHY_1M                       0x01
+#define LE_PHY_2M                       0x02
+#define LE_PHY_CODED                    0x04
+
+/* Default link policy bits */
+#define LINK_POLICY_ROLE_SWITCH         0x0001
+#define LINK_POLICY_SNIFF               0x0004
+
+/*
+ * Classic link profile: whether links may drop into sniff and how much
+ * air time page scan takes away from ACL traffic. The other throughput
+ * levers are out of reach from here. The stack sends its own Change
+ * Connection Packet Type (3-DH5 and friends) on every new link, so ours
+ * would race it. The controller's ACL buffers are fixed by the firmware;
+ * HCI only lets the host read their size.
+ */
+struct link_profile {
+	const char *name;
+	uint16_t link_policy;
+	uint16_t page_scan_interval;    /* slots of 0.625 ms */
+	uint16_t page_scan_window;
+};
+
+/***********************************************************
+ *  Local variables
+ ***********************************************************
+ */
+static uint8_t le_features[8];
+
+static const struct link_profile link_profiles[] = {
+	/* Controller defaults, nothing is sent */
+	{ "default",    0, 0, 0 },
+	/* Links stay active, page scan every 2.56 s for 11.25 ms */
+	{ "throughput", LINK_POLICY_ROLE_SWITCH, 0x1000, 0x0012 },
+	/* Idle links may sniff, spec default page scan */
+	{ "quiet",      LINK_POLICY_ROLE_SWITCH | LINK_POLICY_SNIFF,
+		0x0800, 0x0012 },
+};
+
+static const struct link_profile *link_profile = &link_profiles[0];
+static int link_idx;
+static int tx_power_sent;
+#ifdef HCI_CMD_MARVELL_SET_TX_POWER
+static int8_t tx_power_dbm;
+#endif
+
+/***********************************************************
+ *  Local functions
+ ***********************************************************
+ */
+static int le_feature(int bit)
+{
+	return le_features[bit / 8] & (1 << (bit % 8));
+}
+
+static int build_cmd(uint8_t *p_cmd, uint16_t opcode, const uint8_t *p_param,
+		uint8_t len)
+{
+	p_cmd[0] = H4_TYPE_CMD;
+	p_cmd[1] = (uint8_t) opcode;
+	p_cmd[2] = (uint8_t) (opcode >> 8);
+	p_cmd[3] = len;
+	if (len)
+		memcpy(p_cmd + 4, p_param, len);
+
+	return 4 + len;
+}
+
+static int link_want_any(void)
+{
+	return link_profile != &link_profiles[0];
+}
+
+static int le_want_any(void)
+{
+	return vnd_conf.le_max_tx_octets || vnd_conf.le_default_phy;
+}
+
+static uint8_t le_phys(void)
+{
+	uint8_t phys = vnd_conf.le_default_phy & LE_PHY_1M;
+
+	if (le_feature(LE_FEAT_2M_PHY))
+		phys |= vnd_conf.le_default_phy & LE_PHY_2M;
+	if (le_feature(LE_FEAT_CODED_PHY))
+		phys |= vnd_conf.le_default_phy & LE_PHY_CODED;
+
+	return phys;
+}
+
+/***********************************************************
+ *  Global functions
+ ***********************************************************
+ */
+
+/* TRUE if something has to be sent after the stack's HCI_Reset */
+int hci_cfg_mrvl_needed(void)
+{
+	return le_want_any() || link_want_any() || tx_power_mrvl_needed();
+}
+
+int hci_cfg_mrvl_set_link_profile(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(link_profiles) / sizeof(link_profiles[0]); i++) {
+		if (!strcmp(link_profiles[i].name, name)) {
+			link_profile = &link_profiles[i];
+			ALOGI("Select link profile %s", name);
+			return 0;
+		}
+	}
+
+	ALOGE("Unknown link profile %s", name);
+	return -1;
+}
+
+/*
+ * Fill in the idx-th command of the selected link profile. Returns the
+ * parameter length, or -1 when there are no more commands.
+ */
+int hci_cfg_mrvl_link_cmd(int idx, uint16_t *p_opcode, uint8_t *p_param)
+{
+	if (!link_want_any())
+		return -1;
+
+	switch (idx) {
+	case 0:
+		*p_opcode = HCI_WRITE_DEF_LINK_POLICY;
+		p_param[0] = (uint8_t) link_profile->link_policy;
+		p_param[1] = (uint8_t) (link_profile->link_policy >> 8);
+		return 2;
+	case 1:
+		*p_opcode = HCI_WRITE_PAGE_SCAN_ACTIVITY;
+		p_param[0] = (uint8_t) link_profile->page_scan_interval;
+		p_param[1] = (uint8_t) (link_profile->page_scan_interval >> 8);
+		p_param[2] = (uint8_t) link_profile->page_scan_window;
+		p_param[3] = (uint8_t) (link_profile->page_scan_window >> 8);
+		return 4;
+	default:
+		break;
+	}
+
+	return -1;
+}
+
+/*
+ * Build the next post-reset command into p_cmd (H4 framed) and return its
+ * length, or 0 when the sequence is over. done is the opcode that just
+ * completed (0 to start), p_ret/ret_len its return parameters after the
+ * status byte.
+ */
+int hci_cfg_mrvl_post_reset(uint16_t done, uint8_t status,
+		const uint8_t *p_ret, int ret_len, uint8_t *p_cmd)
+{
+	uint16_t opcode;
+	uint8_t param[HCI_CFG_MAX_PARAM];
+	uint8_t phys;
+	int len;
+
+	if (done && status)
+		ALOGW("post reset: cmd 0x%04X failed (0x%02X)", done, status);
+
+	switch (done) {
+	case 0:
+		link_idx = 0;
+		tx_power_sent = FALSE;
+		if (le_want_any()) {
+			memset(le_features, 0, sizeof(le_features));
+			return build_cmd(p_cmd, HCI_LE_READ_LOCAL_FEATURES,
+					NULL, 0);
+		}
+		break;
+
+	case HCI_LE_READ_LOCAL_FEATURES:
+		if (!status && ret_len >= (int) sizeof(le_features))
+			memcpy(le_features, p_ret, sizeof(le_features));
+
+		if (vnd_conf.le_max_tx_octets) {
+			if (le_feature(LE_FEAT_DATA_LEN_EXT)) {
+				param[0] = (uint8_t) vnd_conf.le_max_tx_octets;
+				param[1] = (uint8_t) (vnd_conf.le_max_tx_octets >> 8);
+				param[2] = (uint8_t) vnd_conf.le_max_tx_time;
+				param[3] = (uint8_t) (vnd_conf.le_max_tx_time >> 8);
+				ALOGI("LE suggested data length %u octets %u us",
+					vnd_conf.le_max_tx_octets,
+					vnd_conf.le_max_tx_time);
+				return build_cmd(p_cmd,
+					HCI_LE_WRITE_SUGG_DEF_DATA_LEN, param, 4);
+			}
+			ALOGI("LE data length extension not supported");
+		}
+		/* fall through */
+	case HCI_LE_WRITE_SUGG_DEF_DATA_LEN:
+		phys = le_phys();
+		if (vnd_conf.le_default_phy && phys) {
+			param[0] = 0x00;  /* all_phys: tx and rx given */
+			param[1] = phys;
+			param[2] = phys;
+			ALOGI("LE default PHY 0x%02X", phys);
+			return build_cmd(p_cmd, HCI_LE_SET_DEFAULT_PHY, param, 3);
+		}
+		break;
+
+#ifdef HCI_CMD_MARVELL_SET_TX_POWER
+	case HCI_CMD_MARVELL_SET_TX_POWER:
+		tx_power_mrvl_applied(tx_power_dbm, !status);
+		return 0;
+#endif
+
+	default:
+		break;
+	}
+
+	/* LE part done, continue with the classic link profile */
+	len = hci_cfg_mrvl_link_cmd(link_idx, &opcode, param);
+	if (len >= 0) {
+		link_idx++;
+		return build_cmd(p_cmd, opcode, param, len);
+	}
+
+#ifdef HCI_CMD_MARVELL_SET_TX_POWER
+	/* TX power last, the reset put the controller back to its own */
+	if (!tx_power_sent && tx_power_mrvl_initial(&tx_power_dbm)) {
+		tx_power_sent = TRUE;
+		param[0] = (uint8_t) tx_power_dbm;
+		return build_cmd(p_cmd, HCI_CMD_MARVELL_SET_TX_POWER, param, 1);
+	}
+#endif
+
+	return 0;
+}
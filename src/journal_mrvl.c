@@ -0,0 +1,169 @@
+/******************************************************************************
+ *
+ *  Copyright (C) 2012 Marvell International Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at:
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+/******************************************************************************
+ *
+ *  Filename:      journal_mrvl.c
+ *
+ *  Description:   Writes one mrvl_journal_rec per enable. The write runs
+ *                 on a short-lived writer thread so the enable path never
+ *                 waits on storage; cleanup joins the last one.
+ *
+ ******************************************************************************/
+
+#define LOG_TAG "bt_mrvl"
+
+#include <utils/Log.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bt_vendor_mrvl.h"
+#include "mrvl_journal.h"
+
+/***********************************************************
+ *  Local variables
+ ***********************************************************
+ */
+static pthread_mutex_t journal_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t journal_next_seq;
+static int journal_seq_known;
+
+/* Last writer thread, joined by the next record or by cleanup */
+static pthread_mutex_t journal_thread_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t journal_thread;
+static int journal_thread_started;
+
+/***********************************************************
+ *  Local functions
+ ***********************************************************
+ */
+
+/* Continue after the newest valid record already in the file */
+static void journal_scan(int fd)
+{
+	struct mrvl_journal_rec rec;
+	int i;
+
+	journal_next_seq = 0;
+	for (i = 0; i < MRVL_JOURNAL_SLOTS; i++) {
+		if (pread(fd, &rec, sizeof(rec), i * sizeof(rec)) !=
+				sizeof(rec))
+			break;
+		if (mrvl_journal_valid(&rec) && rec.seq >= journal_next_seq)
+			journal_next_seq = rec.seq + 1;
+	}
+	journal_seq_known = TRUE;
+}
+
+static void *journal_write_thread(void *arg)
+{
+	struct mrvl_journal_rec *rec = arg;
+	int fd;
+
+	pthread_mutex_lock(&journal_lock);
+
+	fd = open(vnd_conf.journal_file, O_RDWR | O_CREAT | O_CLOEXEC, 0660);
+	if (fd < 0) {
+		ALOGW("journal: cannot open %s: %s", vnd_conf.journal_file,
+			strerror(errno));
+		goto out;
+	}
+
+	if (!journal_seq_known)
+		journal_scan(fd);
+
+	rec->seq = journal_next_seq++;
+	rec->crc = mrvl_journal_crc(rec);
+
+	if (pwrite(fd, rec, sizeof(*rec),
+			(rec->seq % MRVL_JOURNAL_SLOTS) * sizeof(*rec)) !=
+			sizeof(*rec))
+		ALOGW("journal: write failed: %s", strerror(errno));
+	else
+		fdatasync(fd);
+
+	close(fd);
+out:
+	pthread_mutex_unlock(&journal_lock);
+	free(rec);
+	return NULL;
+}
+
+/* Called with journal_thread_lock held */
+static void journal_join(void)
+{
+	if (!journal_thread_started)
+		return;
+
+	pthread_join(journal_thread, NULL);
+	journal_thread_started = FALSE;
+}
+
+/***********************************************************
+ *  Global functions
+ ***********************************************************
+ */
+void journal_mrvl_record(const struct mrvl_enable_stats *st)
+{
+	struct mrvl_journal_rec *rec;
+
+	if (!vnd_conf.journal_file[0])
+		return;
+
+	rec = calloc(1, sizeof(*rec));
+	if (!rec)
+		return;
+
+	rec->magic = MRVL_JOURNAL_MAGIC;
+	rec->time = (uint32_t) time(NULL);
+	rec->power_ms = st->power_ms;
+	rec->open_ms = st->open_ms;
+	rec->open_retries = st->open_retries;
+	rec->fwcfg_ms = st->fwcfg_ms;
+	rec->total_ms = st->total_ms;
+	rec->cpu_ms = st->cpu_ms;
+	rec->cmd_failures = st->cmd_failures;
+	rec->result = st->result;
+
+	/*
+	 * One record per enable: the previous writer has long finished by
+	 * now, so this join only reaps it.
+	 */
+	pthread_mutex_lock(&journal_thread_lock);
+	journal_join();
+	if (pthread_create(&journal_thread, NULL, journal_write_thread, rec)) {
+		ALOGW("journal: cannot start writer");
+		free(rec);
+	} else {
+		journal_thread_started = TRUE;
+	}
+	pthread_mutex_unlock(&journal_thread_lock);
+}
+
+/* Wait for a pending write; the lib may be unloaded after cleanup */
+void journal_mrvl_stop(void)
+{
+	pthread_mutex_lock(&journal_thread_lock);
+	journal_join();
+	pthread_mutex_unlock(&journal_thread_lock);
+}
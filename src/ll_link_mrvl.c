@@ -0,0 +1,201 @@
+/******************************************************************************
+ *
+ *  Copyright (C) 2012 Marvell International Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at:
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+/******************************************************************************
+ *
+ *  Filename:      ll_link_mrvl.c
+ *
+ *  Description:   Book keeping of connections put in low latency mode by
+ *                 hw_mrvl_set_low_latency(): the link policy to restore,
+ *                 and the gaps between ACL packets the device sends, which
+ *                 is the input report latency the host sees.
+ *
+ ******************************************************************************/
+
+#define LOG_TAG "bt_mrvl"
+
+#include <utils/Log.h>
+#include <pthread.h>
+#include <string.h>
+
+#include "bt_vendor_mrvl.h"
+
+#define LL_MAX_LINKS     4
+
+/* Report gap buckets: <2.5ms, <5ms, <10ms, <20ms, >= 20ms */
+#define LL_GAP_BUCKETS   5
+
+struct ll_link {
+	int used;
+	uint16_t handle;
+	uint16_t saved_policy;
+	uint64_t last_ns;
+	uint32_t pkts;
+	uint32_t max_gap_us;
+	uint64_t sum_gap_us;
+	uint32_t gap_hist[LL_GAP_BUCKETS];
+};
+
+/***********************************************************
+ *  Local variables
+ ***********************************************************
+ */
+static pthread_mutex_t ll_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct ll_link ll_links[LL_MAX_LINKS];
+static volatile int ll_count;
+
+/***********************************************************
+ *  Local functions
+ ***********************************************************
+ */
+static struct ll_link *ll_find(uint16_t handle)
+{
+	int i;
+
+	for (i = 0; i < LL_MAX_LINKS; i++)
+		if (ll_links[i].used && ll_links[i].handle == handle)
+			return &ll_links[i];
+
+	return NULL;
+}
+
+/* Caller holds ll_lock */
+static void ll_log(const struct ll_link *l, const char *why)
+{
+	if (!l->pkts)
+		return;
+
+	ALOGI("low latency 0x%03X %s: %u reports, avg gap %u us max %u us "
+		"hist <2.5/5/10/20/+ms %u/%u/%u/%u/%u", l->handle, why,
+		l->pkts, l->pkts > 1 ?
+		(uint32_t) (l->sum_gap_us / (l->pkts - 1)) : 0, l->max_gap_us,
+		l->gap_hist[0], l->gap_hist[1], l->gap_hist[2],
+		l->gap_hist[3], l->gap_hist[4]);
+}
+
+/***********************************************************
+ *  Global functions
+ ***********************************************************
+ */
+int ll_link_mrvl_add(uint16_t handle, uint16_t saved_policy)
+{
+	struct ll_link *l;
+	int i;
+
+	pthread_mutex_lock(&ll_lock);
+	l = ll_find(handle);
+	for (i = 0; !l && i < LL_MAX_LINKS; i++)
+		if (!ll_links[i].used)
+			l = &ll_links[i];
+	if (!l) {
+		pthread_mutex_unlock(&ll_lock);
+		return -1;
+	}
+	if (!l->used)
+		ll_count++;
+	memset(l, 0, sizeof(*l));
+	l->used = TRUE;
+	l->handle = handle;
+	l->saved_policy = saved_policy;
+	pthread_mutex_unlock(&ll_lock);
+
+	return 0;
+}
+
+/* Policy the link had before, -1 if it is not tracked */
+int ll_link_mrvl_policy(uint16_t handle)
+{
+	struct ll_link *l;
+	int policy = -1;
+
+	pthread_mutex_lock(&ll_lock);
+	l = ll_find(handle);
+	if (l)
+		policy = l->saved_policy;
+	pthread_mutex_unlock(&ll_lock);
+
+	return policy;
+}
+
+/* Forget the link; returns the policy to restore or -1 if unknown */
+int ll_link_mrvl_remove(uint16_t handle, const char *why)
+{
+	struct ll_link *l;
+	int policy = -1;
+
+	pthread_mutex_lock(&ll_lock);
+	l = ll_find(handle);
+	if (l) {
+		ll_log(l, why);
+		policy = l->saved_policy;
+		l->used = FALSE;
+		ll_count--;
+	}
+	pthread_mutex_unlock(&ll_lock);
+
+	return policy;
+}
+
+/* ACL from the controller; nearly free while no link is tracked */
+void ll_link_mrvl_acl_rx(uint16_t handle, uint64_t ts)
+{
+	struct ll_link *l;
+	uint32_t gap_us;
+	int b;
+
+	if (!ll_count)
+		return;
+
+	pthread_mutex_lock(&ll_lock);
+	l = ll_find(handle);
+	if (l) {
+		if (l->last_ns) {
+			gap_us = (uint32_t) ((ts - l->last_ns) / 1000);
+			l->sum_gap_us += gap_us;
+			if (gap_us > l->max_gap_us)
+				l->max_gap_us = gap_us;
+			for (b = 0; b < LL_GAP_BUCKETS - 1; b++)
+				if (gap_us < (2500U << b))
+					break;
+			l->gap_hist[b]++;
+		}
+		l->last_ns = ts;
+		l->pkts++;
+	}
+	pthread_mutex_unlock(&ll_lock);
+}
+
+/* The controller dropped the per link settings with the link */
+void ll_link_mrvl_link_down(uint16_t handle)
+{
+	if (ll_count)
+		ll_link_mrvl_remove(handle, "disconnected");
+}
+
+void ll_link_mrvl_reset(void)
+{
+	int i;
+
+	pthread_mutex_lock(&ll_lock);
+	for (i = 0; i < LL_MAX_LINKS; i++)
+		if (ll_links[i].used)
+			ll_log(&ll_links[i], "closed");
+	memset(ll_links, 0, sizeof(ll_links));
+	ll_count = 0;
+	pthread_mutex_unlock(&ll_lock);
+}
@@ -0,0 +1,112 @@
+/******************************************************************************
+ *
+ *  Copyright (C) 2012 Marvell International Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at:
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+/******************************************************************************
+ *
+ *  Filename:      pm_qos_mrvl.c
+ *
+ *  Description:   CPU wake-up latency request held while the lib waits on
+ *                 the controller. The kernel keeps the request as long as
+ *                 /dev/cpu_dma_latency stays open.
+ *
+ ******************************************************************************/
+
+#define LOG_TAG "bt_mrvl"
+
+#include <utils/Log.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bt_vendor_mrvl.h"
+
+#define PM_QOS_DEV "/dev/cpu_dma_latency"
+
+/***********************************************************
+ *  Local variables
+ ***********************************************************
+ */
+static pthread_mutex_t qos_lock = PTHREAD_MUTEX_INITIALIZER;
+static int qos_fd = -1;
+static int qos_holders;
+static struct timespec qos_start;
+static uint32_t qos_total_ms;
+
+/***********************************************************
+ *  Global functions
+ ***********************************************************
+ */
+void pm_qos_mrvl_acquire(int who)
+{
+	int32_t latency = (int32_t) vnd_conf.cpu_latency_us;
+
+	if (!vnd_conf.cpu_latency_us)
+		return;
+
+	pthread_mutex_lock(&qos_lock);
+
+	if (!qos_holders) {
+		qos_fd = open(PM_QOS_DEV, O_WRONLY | O_CLOEXEC);
+		if (qos_fd < 0) {
+			ALOGW("Cannot open %s: %s", PM_QOS_DEV,
+				strerror(errno));
+		} else if (write(qos_fd, &latency, sizeof(latency)) !=
+				sizeof(latency)) {
+			ALOGW("Cannot request %d us CPU latency: %s", latency,
+				strerror(errno));
+			close(qos_fd);
+			qos_fd = -1;
+		} else {
+			clock_gettime(CLOCK_MONOTONIC, &qos_start);
+		}
+	}
+	qos_holders |= who;
+
+	pthread_mutex_unlock(&qos_lock);
+}
+
+void pm_qos_mrvl_release(int who)
+{
+	struct timespec now;
+	uint32_t held_ms;
+
+	pthread_mutex_lock(&qos_lock);
+
+	if (!(qos_holders & who)) {
+		pthread_mutex_unlock(&qos_lock);
+		return;
+	}
+
+	qos_holders &= ~who;
+	if (!qos_holders && qos_fd >= 0) {
+		close(qos_fd);
+		qos_fd = -1;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		held_ms = (uint32_t) ((now.tv_sec - qos_start.tv_sec) * 1000 +
+			(now.tv_nsec - qos_start.tv_nsec) / 1000000);
+		qos_total_ms += held_ms;
+		ALOGI("CPU latency request held %u ms (%u ms total)",
+			held_ms, qos_total_ms);
+	}
+
+	pthread_mutex_unlock(&qos_lock);
+}
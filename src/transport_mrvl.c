@@ -0,0 +1,979 @@
+/******************************************************************************
+ *
+ *  Copyright (C) 2012 Marvell International Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at:
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+/******************************************************************************
+ *
+ *  Filename:      transport_mrvl.c
+ *
+ *  Description:   Optional H4 relay between the stack and the controller
+ *                 port. The stack gets one end of a socketpair; a relay
+ *                 thread frames the H4 stream in both directions so the
+ *                 lib can look at packets on their way through.
+ *
+ ******************************************************************************/
+
+#define LOG_TAG "bt_mrvl"
+
+#include <utils/Log.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include "bt_vendor_mrvl.h"
+
+/* Largest H4 packet: type + ACL header + 16 bit length */
+#define H4_MAX_PKT           (1 + 4 + 0xFFFF)
+#define H4_BUF_SIZE          (H4_MAX_PKT + 4096)
+
+#define HCI_EVT_CONN_COMPLETE        0x03
+#define HCI_EVT_DISCONN_COMPLETE     0x05
+#define HCI_EVT_CMD_COMPLETE         0x0E
+#define HCI_EVT_CMD_STATUS           0x0F
+#define HCI_EVT_SYNC_CONN_COMPLETE   0x2C
+#define HCI_EVT_LE_META              0x3E
+
+#define HCI_LE_CONN_COMPLETE         0x01
+#define HCI_LE_ENH_CONN_COMPLETE     0x0A
+
+#define HCI_LINK_TYPE_SCO            0x00
+#define HCI_LINK_TYPE_ESCO           0x02
+
+/* SCO/eSCO links tracked at once */
+#define MAX_SCO_LINKS                4
+
+#define HCI_RESET                    0x0C03
+#define HCI_READ_RSSI                0x1405
+
+/* Largest command the lib injects on its own */
+#define INJ_MAX              (4 + 255)
+
+/* Lib commands queued while the stack runs, and how long one may take */
+#define LIB_CMD_SLOTS        4
+#define LIB_CMD_TIMEOUT_MS   2000
+
+/* Packet gap histogram buckets: <1ms, <2ms, <4ms ... >= 64ms */
+#define SCO_GAP_BUCKETS      8
+
+/* ACL payload size buckets: LE 27, LE DLE 251, 3-DH5 1021, larger */
+#define ACL_SIZE_BUCKETS     4
+
+/* Command latency: opcodes tracked, buckets <0.5ms, <1ms ... >= 128ms */
+#define CMD_LAT_SLOTS        128 /* power of two */
+#define CMD_LAT_PROBES       8
+#define CMD_LAT_BUCKETS      10
+
+/*
+ * Throughput accounting costs a few instructions per packet and syscall;
+ * it is built only into MRVL_RELAY_STATS builds such as the relay bench.
+ */
+#ifdef MRVL_RELAY_STATS
+#define RELAY_STAT(x)        x
+#else
+#define RELAY_STAT(x)        do { } while (0)
+#endif
+
+struct relay_dir_stats {
+	uint64_t bytes;
+	uint32_t reads;
+	uint32_t writes;
+	uint32_t acl_pkts;
+	uint32_t acl_size_hist[ACL_SIZE_BUCKETS];
+};
+
+struct h4_stream {
+	int in_fd;
+	int out_fd;
+	int dir;
+	int len;
+	int inj_len;               /* bytes queued for out_fd after this pkt */
+	int held_len;              /* packet held back while the lib works */
+	uint8_t inj[INJ_MAX];
+	uint8_t held[INJ_MAX];
+#ifdef MRVL_RELAY_STATS
+	struct relay_dir_stats stats;
+#endif
+	uint8_t buf[H4_BUF_SIZE];
+};
+
+struct lib_cmd {
+	int len;
+	transport_mrvl_cmd_cb p_cb;
+	uint8_t cmd[INJ_MAX];
+};
+
+struct cmd_lat_stats {
+	uint16_t opcode;           /* 0 when the slot is free */
+	uint64_t sent_ns;          /* 0 when no command is outstanding */
+	uint32_t count;
+	uint32_t by_status;        /* answered by Command Status */
+	uint32_t max_us;
+	uint64_t sum_us;
+	uint32_t hist[CMD_LAT_BUCKETS];
+};
+
+struct sco_dir_stats {
+	uint64_t last_ns;
+	uint32_t last_gap_us;
+	uint32_t pkts;
+	uint32_t jitter_us;        /* smoothed like RFC 3550, J += (|D|-J)/16 */
+	uint32_t max_gap_us;
+	uint32_t gap_hist[SCO_GAP_BUCKETS];
+};
+
+/***********************************************************
+ *  Local variables
+ ***********************************************************
+ */
+static pthread_t relay_thread;
+static int relay_running;
+static int relay_wake[2] = { -1, -1 };
+static int relay_sock[2] = { -1, -1 };
+static struct h4_stream stream_rx;      /* controller -> host */
+static struct h4_stream stream_tx;      /* host -> controller */
+
+static struct sco_dir_stats sco_stats[MRVL_DIR_MAX];
+#ifdef MRVL_RELAY_STATS
+static const int acl_size_limit[ACL_SIZE_BUCKETS - 1] = { 27, 251, 1021 };
+#endif
+#ifdef MRVL_RELAY_STATS
+static uint64_t relay_start_ns;
+static uint64_t relay_stop_ns;
+static uint64_t relay_cpu_ns;
+#endif
+
+/* Per opcode command latency, no allocation on the packet path */
+static struct cmd_lat_stats cmd_lat[CMD_LAT_SLOTS];
+static uint32_t cmd_lat_untracked;
+
+/* Open SCO/eSCO connection handles, 0xFFFF when unused */
+static uint16_t sco_handles[MAX_SCO_LINKS];
+
+/* Post-reset sequence: opcode in flight, 0 when idle */
+static uint16_t post_reset_opcode;
+static uint64_t post_reset_start;
+
+/*
+ * Commands the lib sends while the stack runs, relay thread only. One
+ * goes out when the stack has no command outstanding, and the stack's
+ * side is not read until its answer is in, so the controller never sees
+ * more commands than the stack was given credit for.
+ */
+static struct lib_cmd lib_cmds[LIB_CMD_SLOTS];
+static int lib_cmd_head;
+static int lib_cmd_count;
+static uint16_t lib_cmd_opcode;    /* in flight, 0 when none */
+static uint16_t lib_cmd_stale;     /* timed out, answer still to come */
+static uint64_t lib_cmd_deadline;
+static int stack_cmd_out;          /* stack commands not answered yet */
+
+/***********************************************************
+ *  Local functions
+ ***********************************************************
+ */
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#ifdef MRVL_RELAY_STATS
+static uint64_t thread_cpu_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+static int stream_write(struct h4_stream *s, const uint8_t *p, int len)
+{
+	int n;
+
+	while (len > 0) {
+		RELAY_STAT(s->stats.writes++);
+		/* No SIGPIPE once stop has shut the stack's socket down */
+		if (s->dir == MRVL_DIR_RX)
+			n = send(s->out_fd, p, len, MSG_NOSIGNAL);
+		else
+			n = write(s->out_fd, p, len);
+		if (n < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/*
+ * Size of the H4 packet at p, 0 if more bytes are needed, -1 if the
+ * packet type is unknown and the stream can no longer be framed.
+ */
+static int h4_pkt_len(const uint8_t *p, int avail)
+{
+	int hdr;
+	int len;
+
+	switch (p[0]) {
+	case H4_TYPE_CMD:
+	case H4_TYPE_SCO:
+		hdr = 4;
+		if (avail < hdr)
+			return 0;
+		len = hdr + p[3];
+		break;
+	case H4_TYPE_ACL:
+		hdr = 5;
+		if (avail < hdr)
+			return 0;
+		len = hdr + (p[3] | (p[4] << 8));
+		break;
+	case H4_TYPE_EVT:
+		hdr = 3;
+		if (avail < hdr)
+			return 0;
+		len = hdr + p[2];
+		break;
+	default:
+		return -1;
+	}
+
+	return avail < len ? 0 : len;
+}
+
+#ifdef MRVL_RELAY_STATS
+static void acl_stats_update(struct relay_dir_stats *rs, int len)
+{
+	int b;
+
+	for (b = 0; b < ACL_SIZE_BUCKETS - 1; b++)
+		if (len - 5 <= acl_size_limit[b])
+			break;
+	rs->acl_pkts++;
+	rs->acl_size_hist[b]++;
+}
+#endif
+
+static void sco_stats_update(int dir, uint64_t ts)
+{
+	struct sco_dir_stats *st = &sco_stats[dir];
+	uint32_t gap_us;
+	uint32_t d;
+	int b;
+
+	st->pkts++;
+	if (!st->last_ns) {
+		st->last_ns = ts;
+		return;
+	}
+
+	gap_us = (uint32_t) ((ts - st->last_ns) / 1000);
+	st->last_ns = ts;
+
+	d = gap_us > st->last_gap_us ? gap_us - st->last_gap_us :
+		st->last_gap_us - gap_us;
+	st->jitter_us += ((int32_t) d - (int32_t) st->jitter_us) / 16;
+	st->last_gap_us = gap_us;
+
+	if (gap_us > st->max_gap_us)
+		st->max_gap_us = gap_us;
+
+	for (b = 0; b < SCO_GAP_BUCKETS - 1; b++)
+		if (gap_us < (1000U << b))
+			break;
+	st->gap_hist[b]++;
+}
+
+static struct cmd_lat_stats *cmd_lat_slot(uint16_t opcode, int add)
+{
+	struct cmd_lat_stats *e;
+	uint32_t h = (opcode ^ (opcode >> 7)) & (CMD_LAT_SLOTS - 1);
+	int i;
+
+	for (i = 0; i < CMD_LAT_PROBES; i++) {
+		e = &cmd_lat[(h + i) & (CMD_LAT_SLOTS - 1)];
+		if (e->opcode == opcode)
+			return e;
+		if (!e->opcode) {
+			if (!add)
+				return NULL;
+			e->opcode = opcode;
+			return e;
+		}
+	}
+
+	return NULL;
+}
+
+static void cmd_lat_sent(const uint8_t *p, int len, uint64_t ts)
+{
+	struct cmd_lat_stats *e;
+	uint16_t opcode = p[1] | (p[2] << 8);
+
+	if (!opcode)
+		return;
+
+	e = cmd_lat_slot(opcode, TRUE);
+	if (!e) {
+		cmd_lat_untracked++;
+		return;
+	}
+	e->sent_ns = ts;
+}
+
+/* Command Complete or Command Status for a command the stack sent */
+static void cmd_lat_done(const uint8_t *p, int len, uint64_t ts)
+{
+	struct cmd_lat_stats *e;
+	uint16_t opcode;
+	uint32_t us;
+	int b;
+
+	if (p[1] == HCI_EVT_CMD_COMPLETE)
+		opcode = p[4] | (p[5] << 8);
+	else if (len >= 7)
+		opcode = p[5] | (p[6] << 8);
+	else
+		return;
+
+	e = opcode ? cmd_lat_slot(opcode, FALSE) : NULL;
+	if (!e || !e->sent_ns)
+		return;
+
+	us = (uint32_t) ((ts - e->sent_ns) / 1000);
+	e->sent_ns = 0;
+	e->count++;
+	if (p[1] == HCI_EVT_CMD_STATUS)
+		e->by_status++;
+	e->sum_us += us;
+	if (us > e->max_us)
+		e->max_us = us;
+	for (b = 0; b < CMD_LAT_BUCKETS - 1; b++)
+		if (us < (500U << b))
+			break;
+	e->hist[b]++;
+}
+
+/* The lib command in flight is over; pass the result on */
+static void lib_cmd_done(uint8_t status)
+{
+	struct lib_cmd *c = &lib_cmds[lib_cmd_head];
+	uint16_t opcode = c->cmd[1] | (c->cmd[2] << 8);
+
+	if (status)
+		ALOGW("relay: cmd 0x%04X failed (0x%02X)", opcode, status);
+
+	lib_cmd_opcode = 0;
+	lib_cmd_head = (lib_cmd_head + 1) % LIB_CMD_SLOTS;
+	lib_cmd_count--;
+	if (c->p_cb)
+		c->p_cb(opcode, status);
+}
+
+/* Send the oldest queued lib command if the command channel is free */
+static void lib_cmd_kick(void)
+{
+	struct lib_cmd *c = &lib_cmds[lib_cmd_head];
+
+	if (!lib_cmd_count || lib_cmd_opcode || stack_cmd_out ||
+			post_reset_opcode || stream_rx.held_len)
+		return;
+
+	if (stream_write(&stream_tx, c->cmd, c->len) < 0) {
+		lib_cmd_done(0xFF);
+		return;
+	}
+	lib_cmd_opcode = c->cmd[1] | (c->cmd[2] << 8);
+	lib_cmd_deadline = now_ns() + LIB_CMD_TIMEOUT_MS * 1000000ULL;
+}
+
+/* Give up on a lib command the controller did not answer in time */
+static void lib_cmd_expire(void)
+{
+	if (!lib_cmd_opcode || now_ns() < lib_cmd_deadline)
+		return;
+
+	ALOGW("relay: no answer to cmd 0x%04X", lib_cmd_opcode);
+	lib_cmd_stale = lib_cmd_opcode;
+	lib_cmd_done(0xFF);
+}
+
+/*
+ * Command credit bookkeeping on Command Complete and Command Status.
+ * Returns TRUE for the answer to a lib command, which the stack must
+ * not see.
+ */
+static int lib_cmd_evt(const uint8_t *p, int len)
+{
+	uint16_t opcode;
+	uint8_t status;
+
+	if (p[1] == HCI_EVT_CMD_COMPLETE) {
+		opcode = p[4] | (p[5] << 8);
+		status = len > 6 ? p[6] : 0xFF;
+	} else if (len >= 7) {
+		opcode = p[5] | (p[6] << 8);
+		status = p[3];
+	} else {
+		return FALSE;
+	}
+
+	/* Opcode 0 only hands out credit */
+	if (!opcode)
+		return FALSE;
+
+	if (lib_cmd_opcode && opcode == lib_cmd_opcode) {
+		lib_cmd_done(status);
+		return TRUE;
+	}
+	if (lib_cmd_stale && opcode == lib_cmd_stale) {
+		lib_cmd_stale = 0;
+		return TRUE;
+	}
+
+	/* Post-reset commands are ours too, the stack never counted them */
+	if (opcode != post_reset_opcode && stack_cmd_out > 0)
+		stack_cmd_out--;
+	return FALSE;
+}
+
+/* Poll timeout in ms for the lib command in flight, -1 for none */
+static int lib_cmd_tick(void)
+{
+	uint64_t now;
+
+	if (!lib_cmd_opcode)
+		return -1;
+
+	now = now_ns();
+	return now < lib_cmd_deadline ?
+		(int) ((lib_cmd_deadline - now) / 1000000) + 1 : 0;
+}
+
+/*
+ * Send the next post-reset command to the controller, or hand the held
+ * reset Command Complete over to the stack once the sequence is over.
+ */
+static void post_reset_step(struct h4_stream *s, uint16_t done,
+		const uint8_t *p, int len)
+{
+	uint8_t cmd[INJ_MAX];
+	uint8_t status = 0;
+	int n;
+
+	if (done)
+		status = len > 6 ? p[6] : 0xFF;
+
+	n = hci_cfg_mrvl_post_reset(done, status, p + 7, len - 7, cmd);
+	if (n > 0 && stream_write(&stream_tx, cmd, n) == 0) {
+		post_reset_opcode = cmd[1] | (cmd[2] << 8);
+		return;
+	}
+
+	ALOGI("post reset config took %u us",
+		(uint32_t) ((now_ns() - post_reset_start) / 1000));
+	post_reset_opcode = 0;
+	memcpy(s->inj, s->held, s->held_len);
+	s->inj_len = s->held_len;
+	s->held_len = 0;
+}
+
+/* Keep the CPU latency request while any SCO link is up */
+static void sco_link_track(const uint8_t *p, int len)
+{
+	uint16_t handle;
+	int i;
+
+	switch (p[1]) {
+	case HCI_EVT_CONN_COMPLETE:
+	case HCI_EVT_SYNC_CONN_COMPLETE:
+		if (len < 13 || p[3] || (p[12] != HCI_LINK_TYPE_SCO &&
+				p[12] != HCI_LINK_TYPE_ESCO))
+			return;
+		handle = (p[4] | (p[5] << 8)) & 0x0FFF;
+		for (i = 0; i < MAX_SCO_LINKS; i++) {
+			if (sco_handles[i] == 0xFFFF) {
+				sco_handles[i] = handle;
+				break;
+			}
+		}
+		pm_qos_mrvl_acquire(PM_QOS_SCO_LINK);
+		break;
+
+	case HCI_EVT_DISCONN_COMPLETE:
+		if (len < 6 || p[3])
+			return;
+		handle = (p[4] | (p[5] << 8)) & 0x0FFF;
+		for (i = 0; i < MAX_SCO_LINKS; i++)
+			if (sco_handles[i] == handle)
+				sco_handles[i] = 0xFFFF;
+		for (i = 0; i < MAX_SCO_LINKS; i++)
+			if (sco_handles[i] != 0xFFFF)
+				return;
+		pm_qos_mrvl_release(PM_QOS_SCO_LINK);
+		break;
+
+	default:
+		break;
+	}
+}
+
+static int relay_evt(struct h4_stream *s, const uint8_t *p, int len,
+		uint64_t ts)
+{
+	uint16_t opcode;
+
+	if ((p[1] == HCI_EVT_CMD_COMPLETE || p[1] == HCI_EVT_CMD_STATUS) &&
+			len >= 6) {
+		cmd_lat_done(p, len, ts);
+		if (lib_cmd_evt(p, len))
+			return FALSE;
+	}
+
+	if (adv_filter_mrvl_drop(p, len, ts))
+		return FALSE;
+
+	sco_link_track(p, len);
+	vendor_evt_mrvl_tap(p, len);
+
+	if (p[1] == HCI_EVT_DISCONN_COMPLETE && len >= 6 && !p[3]) {
+		tx_power_mrvl_link_down((p[4] | (p[5] << 8)) & 0x0FFF);
+		ll_link_mrvl_link_down((p[4] | (p[5] << 8)) & 0x0FFF);
+	}
+
+	/* Subevent, status, handle; RSSI on LE links is in dBm */
+	if (p[1] == HCI_EVT_LE_META && len >= 7 && !p[4] &&
+			(p[3] == HCI_LE_CONN_COMPLETE ||
+			p[3] == HCI_LE_ENH_CONN_COMPLETE))
+		tx_power_mrvl_le_link_up((p[5] | (p[6] << 8)) & 0x0FFF);
+
+	if (p[1] != HCI_EVT_CMD_COMPLETE || len < 6)
+		return TRUE;
+
+	opcode = p[4] | (p[5] << 8);
+
+	/* Status, handle, RSSI (dBm on LE, golden range offset on BR/EDR) */
+	if (opcode == HCI_READ_RSSI && len >= 10 && !p[6])
+		tx_power_mrvl_rssi((p[7] | (p[8] << 8)) & 0x0FFF,
+			(int8_t) p[9]);
+
+	if (post_reset_opcode && opcode == post_reset_opcode) {
+		/* Our own command, the stack never sent it */
+		post_reset_step(s, opcode, p, len);
+		return FALSE;
+	}
+
+	if (opcode == HCI_RESET && hci_cfg_mrvl_needed()) {
+		/* Hold the stack's reset until the defaults are in place */
+		memcpy(s->held, p, len);
+		s->held_len = len;
+		post_reset_start = now_ns();
+		post_reset_step(s, 0, p, len);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/*
+ * Look at one complete packet. Returns TRUE if it goes on to the other
+ * side, FALSE to drop it. Bytes left in s->inj go out right after it.
+ */
+static int relay_packet(struct h4_stream *s, const uint8_t *p, int len,
+		uint64_t ts)
+{
+	switch (p[0]) {
+	case H4_TYPE_ACL:
+		RELAY_STAT(acl_stats_update(&s->stats, len));
+		/* First fragments only: one per report on HID links */
+		if (s->dir == MRVL_DIR_RX && (p[2] & 0x30) == 0x20)
+			ll_link_mrvl_acl_rx((p[1] | (p[2] << 8)) & 0x0FFF, ts);
+		break;
+	case H4_TYPE_SCO:
+		sco_stats_update(s->dir, ts);
+		break;
+	case H4_TYPE_CMD:
+		cmd_lat_sent(p, len, ts);
+		/* A reset voids whatever the stack had outstanding */
+		if ((p[1] | (p[2] << 8)) == HCI_RESET)
+			stack_cmd_out = 1;
+		else
+			stack_cmd_out++;
+		break;
+	case H4_TYPE_EVT:
+		return relay_evt(s, p, len, ts);
+	default:
+		break;
+	}
+
+	return TRUE;
+}
+
+/*
+ * Pull what is readable from one side, frame it and pass the complete
+ * packets on. Contiguous forwarded packets go out in a single write.
+ */
+static int relay_pump(struct h4_stream *s)
+{
+	uint64_t ts;
+	int fwd, pos, len, end;
+	int keep;
+	int n;
+
+	RELAY_STAT(s->stats.reads++);
+	n = read(s->in_fd, s->buf + s->len, sizeof(s->buf) - s->len);
+	if (n <= 0)
+		return n < 0 && (errno == EINTR || errno == EAGAIN) ? 0 : -1;
+
+	ts = now_ns();
+	s->len += n;
+	RELAY_STAT(s->stats.bytes += n);
+
+	fwd = pos = 0;
+	while (pos < s->len) {
+		len = h4_pkt_len(s->buf + pos, s->len - pos);
+		if (len < 0) {
+			/* Lost framing; hand everything over untouched */
+			ALOGW("relay: unknown H4 type 0x%02X, resync",
+				s->buf[pos]);
+			pos = s->len;
+			break;
+		}
+		if (!len)
+			break;
+
+		keep = relay_packet(s, s->buf + pos, len, ts);
+		if (!keep || s->inj_len) {
+			end = keep ? pos + len : pos;
+			if (end > fwd && stream_write(s, s->buf + fwd,
+					end - fwd) < 0)
+				return -1;
+			fwd = pos + len;
+			if (s->inj_len && stream_write(s, s->inj,
+					s->inj_len) < 0)
+				return -1;
+			s->inj_len = 0;
+		}
+		pos += len;
+	}
+
+	if (pos > fwd && stream_write(s, s->buf + fwd, pos - fwd) < 0)
+		return -1;
+
+	s->len -= pos;
+	if (s->len)
+		memmove(s->buf, s->buf + pos, s->len);
+
+	return 0;
+}
+
+/* Follow RelayThreadNice; checked per wakeup, so a reload is cheap */
+static void relay_apply_nice(const struct mrvl_rt_conf **pp_applied)
+{
+	const struct mrvl_rt_conf *rt = vnd_rt_conf_get();
+
+	if (rt == *pp_applied)
+		return;
+	/* Leave the inherited priority alone unless told otherwise */
+	if (*pp_applied ? rt->relay_nice != (*pp_applied)->relay_nice :
+			rt->relay_nice != 0) {
+		if (setpriority(PRIO_PROCESS, gettid(), rt->relay_nice) < 0)
+			ALOGW("relay: cannot set nice %d: %s", rt->relay_nice,
+				strerror(errno));
+	}
+	*pp_applied = rt;
+}
+
+#ifdef MRVL_RELAY_STATS
+static void relay_dump_throughput(const char * const *dir_name)
+{
+	const struct h4_stream * const streams[MRVL_DIR_MAX] = {
+		&stream_rx, &stream_tx };
+	const struct relay_dir_stats *rs;
+	uint64_t end_ns, wall_us;
+	uint32_t mb_x100;
+	int dir;
+
+	end_ns = relay_stop_ns ? relay_stop_ns : now_ns();
+	wall_us = relay_start_ns ? (end_ns - relay_start_ns) / 1000 : 0;
+
+	for (dir = 0; dir < MRVL_DIR_MAX; dir++) {
+		rs = &streams[dir]->stats;
+		if (!rs->bytes)
+			continue;
+		/* Hundredths of a MB keep the per-MB figures integer */
+		mb_x100 = (uint32_t) (rs->bytes * 100 / (1024 * 1024));
+		ALOGI("relay %s: %llu bytes in %llu ms (%llu KB/s), "
+			"%u reads %u writes, %u syscalls/MB",
+			dir_name[dir], (unsigned long long) rs->bytes,
+			(unsigned long long) wall_us / 1000,
+			(unsigned long long) (wall_us ?
+				rs->bytes * 1000000 / 1024 / wall_us : 0),
+			rs->reads, rs->writes,
+			mb_x100 ? (rs->reads + rs->writes) * 100 / mb_x100 : 0);
+		ALOGI("relay %s: acl pkts %u, payload <=27/<=251/<=1021/+ "
+			"%u/%u/%u/%u", dir_name[dir], rs->acl_pkts,
+			rs->acl_size_hist[0], rs->acl_size_hist[1],
+			rs->acl_size_hist[2], rs->acl_size_hist[3]);
+	}
+
+	if (relay_cpu_ns) {
+		mb_x100 = (uint32_t) ((stream_rx.stats.bytes +
+			stream_tx.stats.bytes) * 100 / (1024 * 1024));
+		ALOGI("relay cpu: %llu ms total, %llu us/MB",
+			(unsigned long long) relay_cpu_ns / 1000000,
+			(unsigned long long) (mb_x100 ?
+				relay_cpu_ns / 10 / mb_x100 : 0));
+	}
+}
+#endif
+
+static void *relay_thread_main(void *arg)
+{
+	const struct mrvl_rt_conf *rt_applied = NULL;
+	struct pollfd pfd[3];
+
+	pfd[0].fd = stream_rx.in_fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = stream_tx.in_fd;
+	pfd[1].events = POLLIN;
+	pfd[2].fd = relay_wake[0];
+	pfd[2].events = POLLIN;
+
+	ALOGI("relay: started");
+
+	for (;;) {
+		relay_apply_nice(&rt_applied);
+
+		lib_cmd_expire();
+		lib_cmd_kick();
+		/* The stack's commands wait while one of ours is in flight */
+		pfd[1].fd = lib_cmd_opcode ? -1 : stream_tx.in_fd;
+
+		if (poll(pfd, 3, lib_cmd_tick()) < 0) {
+			if (errno == EINTR)
+				continue;
+			ALOGE("relay: poll failed: %s", strerror(errno));
+			break;
+		}
+
+		if (pfd[2].revents)
+			break;
+
+		if (pfd[0].revents && relay_pump(&stream_rx) < 0) {
+			ALOGE("relay: controller side closed");
+			break;
+		}
+
+		if (pfd[1].revents && relay_pump(&stream_tx) < 0) {
+			ALOGD("relay: host side closed");
+			break;
+		}
+	}
+
+	RELAY_STAT(relay_cpu_ns = thread_cpu_ns());
+	RELAY_STAT(relay_stop_ns = now_ns());
+	ALOGI("relay: stopped");
+	return NULL;
+}
+
+/***********************************************************
+ *  Global functions
+ ***********************************************************
+ */
+
+/* TRUE if any enabled feature needs to see the packet stream */
+int transport_mrvl_needed(void)
+{
+	return vnd_conf.transport_relay ||
+		vnd_conf.sco_data_path == MRVL_SCO_PATH_HCI ||
+		vnd_conf.le_adv_dedup_ms ||
+		vnd_conf.vendor_evt_tap ||
+		vnd_conf.ll_links ||
+		hci_cfg_mrvl_needed();
+}
+
+int transport_mrvl_start(int port_fd)
+{
+	if (relay_running)
+		transport_mrvl_stop();
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, relay_sock) < 0) {
+		ALOGE("relay: socketpair failed: %s", strerror(errno));
+		return -1;
+	}
+
+	if (pipe(relay_wake) < 0) {
+		ALOGE("relay: pipe failed: %s", strerror(errno));
+		goto fail_sock;
+	}
+
+	stream_rx.in_fd = port_fd;
+	stream_rx.out_fd = relay_sock[1];
+	stream_rx.dir = MRVL_DIR_RX;
+	stream_rx.len = 0;
+	stream_tx.in_fd = relay_sock[1];
+	stream_tx.out_fd = port_fd;
+	stream_tx.dir = MRVL_DIR_TX;
+	stream_tx.len = 0;
+	stream_rx.inj_len = stream_rx.held_len = 0;
+	stream_tx.inj_len = stream_tx.held_len = 0;
+	post_reset_opcode = 0;
+	lib_cmd_head = lib_cmd_count = 0;
+	lib_cmd_opcode = lib_cmd_stale = 0;
+	stack_cmd_out = 0;
+#ifdef MRVL_RELAY_STATS
+	memset(&stream_rx.stats, 0, sizeof(stream_rx.stats));
+	memset(&stream_tx.stats, 0, sizeof(stream_tx.stats));
+#endif
+	memset(sco_stats, 0, sizeof(sco_stats));
+	memset(cmd_lat, 0, sizeof(cmd_lat));
+	cmd_lat_untracked = 0;
+	adv_filter_mrvl_reset();
+	vendor_evt_mrvl_reset();
+	tx_power_mrvl_reset();
+	memset(sco_handles, 0xFF, sizeof(sco_handles));
+	RELAY_STAT(relay_start_ns = now_ns());
+	RELAY_STAT(relay_stop_ns = relay_cpu_ns = 0);
+
+	if (pthread_create(&relay_thread, NULL, relay_thread_main, NULL)) {
+		ALOGE("relay: cannot start thread");
+		goto fail_pipe;
+	}
+	relay_running = TRUE;
+
+	return relay_sock[0];
+
+fail_pipe:
+	close(relay_wake[0]);
+	close(relay_wake[1]);
+	relay_wake[0] = relay_wake[1] = -1;
+fail_sock:
+	close(relay_sock[0]);
+	close(relay_sock[1]);
+	relay_sock[0] = relay_sock[1] = -1;
+	return -1;
+}
+
+/*
+ * Queue an HCI command of the lib's own, for the controller while the
+ * stack is up. The relay sends it between stack commands and swallows
+ * the answer, which goes to p_cb. Relay thread only, e.g. from the
+ * event hooks; returns -1 when the queue is full.
+ */
+int transport_mrvl_send_cmd(uint16_t opcode, const uint8_t *p_param,
+		int param_len, transport_mrvl_cmd_cb p_cb)
+{
+	struct lib_cmd *c;
+
+	if (lib_cmd_count == LIB_CMD_SLOTS || param_len > INJ_MAX - 4)
+		return -1;
+
+	c = &lib_cmds[(lib_cmd_head + lib_cmd_count) % LIB_CMD_SLOTS];
+	c->cmd[0] = H4_TYPE_CMD;
+	c->cmd[1] = (uint8_t) opcode;
+	c->cmd[2] = (uint8_t) (opcode >> 8);
+	c->cmd[3] = (uint8_t) param_len;
+	if (param_len)
+		memcpy(c->cmd + 4, p_param, param_len);
+	c->len = 4 + param_len;
+	c->p_cb = p_cb;
+	lib_cmd_count++;
+	return 0;
+}
+
+void transport_mrvl_stop(void)
+{
+	if (!relay_running)
+		return;
+
+	if (write(relay_wake[1], "x", 1) != 1)
+		ALOGW("relay: wake failed: %s", strerror(errno));
+	/*
+	 * The stack's reader is gone by now; a relay blocked writing into a
+	 * full socket would never see the wake byte. Shutting the socket
+	 * down fails that write and ends the thread either way.
+	 */
+	shutdown(relay_sock[1], SHUT_RDWR);
+	pthread_join(relay_thread, NULL);
+	relay_running = FALSE;
+	pm_qos_mrvl_release(PM_QOS_SCO_LINK);
+
+	transport_mrvl_dump_stats();
+
+	close(relay_wake[0]);
+	close(relay_wake[1]);
+	close(relay_sock[0]);
+	close(relay_sock[1]);
+	relay_wake[0] = relay_wake[1] = -1;
+	relay_sock[0] = relay_sock[1] = -1;
+}
+
+void transport_mrvl_dump_stats(void)
+{
+	static const char * const dir_name[MRVL_DIR_MAX] = { "rx", "tx" };
+	const struct sco_dir_stats *st;
+	const struct cmd_lat_stats *cl;
+	int dir;
+
+#ifdef MRVL_RELAY_STATS
+	relay_dump_throughput(dir_name);
+#endif
+
+	for (cl = cmd_lat; cl < cmd_lat + CMD_LAT_SLOTS; cl++) {
+		if (!cl->count)
+			continue;
+		ALOGI("cmd 0x%04hX: %u done (%u by status) avg %u us max %u us "
+			"hist <0.5/1/2/4/8/16/32/64/128/+ms "
+			"%u/%u/%u/%u/%u/%u/%u/%u/%u/%u", cl->opcode, cl->count,
+			cl->by_status, (uint32_t) (cl->sum_us / cl->count),
+			cl->max_us, cl->hist[0], cl->hist[1], cl->hist[2],
+			cl->hist[3], cl->hist[4], cl->hist[5], cl->hist[6],
+			cl->hist[7], cl->hist[8], cl->hist[9]);
+	}
+	if (cmd_lat_untracked)
+		ALOGI("cmd latency: %u commands not tracked, table full",
+			cmd_lat_untracked);
+
+	adv_filter_mrvl_dump_stats();
+	vendor_evt_mrvl_dump_stats();
+	tx_power_mrvl_dump_stats();
+
+	for (dir = 0; dir < MRVL_DIR_MAX; dir++) {
+		st = &sco_stats[dir];
+		if (!st->pkts)
+			continue;
+		ALOGI("sco %s: pkts %u jitter %u us max gap %u us "
+			"hist <1/2/4/8/16/32/64/+ms %u/%u/%u/%u/%u/%u/%u/%u",
+			dir_name[dir], st->pkts, st->jitter_us, st->max_gap_us,
+			st->gap_hist[0], st->gap_hist[1], st->gap_hist[2],
+			st->gap_hist[3], st->gap_hist[4], st->gap_hist[5],
+			st->gap_hist[6], st->gap_hist[7]);
+	}
+}
@@ -0,0 +1,341 @@
+/******************************************************************************
+ *
+ *  Copyright (C) 2012 Marvell International Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at:
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+/******************************************************************************
+ *
+ *  Filename:      tx_power_mrvl.c
+ *
+ *  Description:   Controller TX power policy. A fixed level goes out after
+ *                 the stack's HCI_Reset; the adaptive policy moves it in
+ *                 steps from the link RSSI the stack reads, keeping the
+ *                 weakest link inside its target range: LE links in
+ *                 [TxPowerRssiLow, TxPowerRssiHigh] dBm, BR/EDR links in
+ *                 the controller's Golden Receive Power Range.
+ *                 Both go out through the relay, never by the stack's
+ *                 xmit path: the RSSI arrives on the relay thread.
+ *
+ ******************************************************************************/
+
+#define LOG_TAG "bt_mrvl"
+
+#include <utils/Log.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+#include "bt_vendor_mrvl.h"
+
+#define MAX_RSSI_LINKS   8
+#define RSSI_MAX_AGE_MS  10000  /* ignore links not read lately */
+
+struct rssi_link {
+	uint16_t handle;
+	int8_t rssi;
+	int le;            /* rssi in dBm; else offset from the golden range */
+	uint32_t ms;
+};
+
+/***********************************************************
+ *  Local variables
+ ***********************************************************
+ */
+static pthread_mutex_t tx_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct rssi_link links[MAX_RSSI_LINKS];
+static uint16_t le_handles[MAX_RSSI_LINKS];  /* 0xFFFF when unused */
+static int cur_dbm;
+static int cur_valid;
+static int change_pending;
+static uint32_t last_change_ms;
+static uint32_t level_since_ms;
+#ifdef HCI_CMD_MARVELL_SET_TX_POWER
+static int8_t sent_dbm;            /* relay thread only */
+#endif
+
+/* Metrics since the last reset */
+static uint32_t raised;
+static uint32_t lowered;
+static uint32_t limited;
+static uint32_t failed;
+static int64_t dbm_ms;
+static uint32_t total_ms;
+
+/***********************************************************
+ *  Local functions
+ ***********************************************************
+ */
+static uint32_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t) (ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+static int clamp_dbm(int dbm)
+{
+	if (dbm < vnd_conf.tx_power_min_dbm)
+		return vnd_conf.tx_power_min_dbm;
+	if (dbm > vnd_conf.tx_power_max_dbm)
+		return vnd_conf.tx_power_max_dbm;
+	return dbm;
+}
+
+/* Account the time spent at the current level, caller holds tx_lock */
+static void level_account(uint32_t now)
+{
+	if (cur_valid) {
+		dbm_ms += (int64_t) cur_dbm * (now - level_since_ms);
+		total_ms += now - level_since_ms;
+	}
+	level_since_ms = now;
+}
+
+/* Caller holds tx_lock */
+static int le_link(uint16_t handle)
+{
+	int i;
+
+	for (i = 0; i < MAX_RSSI_LINKS; i++)
+		if (le_handles[i] == handle)
+			return TRUE;
+
+	return FALSE;
+}
+
+/* Where one link sits: -1 below its target range, 1 above, 0 inside */
+static int link_level(const struct rssi_link *l)
+{
+	/* BR/EDR: 0 is inside the golden range, the sign says which side */
+	if (!l->le)
+		return l->rssi < 0 ? -1 : l->rssi > 0;
+
+	if (l->rssi < vnd_conf.tx_power_rssi_low)
+		return -1;
+	return l->rssi > vnd_conf.tx_power_rssi_high;
+}
+
+/*
+ * -1 if any recent link is below its range, 1 if all of them are above,
+ * 0 otherwise. Caller holds tx_lock.
+ */
+static int links_level(uint32_t now)
+{
+	int level = 1;
+	int i;
+
+	for (i = 0; i < MAX_RSSI_LINKS; i++) {
+		if (!links[i].ms || now - links[i].ms > RSSI_MAX_AGE_MS)
+			continue;
+		switch (link_level(&links[i])) {
+		case -1:
+			return -1;
+		case 0:
+			level = 0;
+			break;
+		default:
+			break;
+		}
+	}
+
+	return level;
+}
+
+#ifdef HCI_CMD_MARVELL_SET_TX_POWER
+static void tx_power_cmd_done(uint16_t opcode, uint8_t status)
+{
+	tx_power_mrvl_applied(sent_dbm, !status);
+}
+#endif
+
+/***********************************************************
+ *  Global functions
+ ***********************************************************
+ */
+int tx_power_mrvl_needed(void)
+{
+#ifdef HCI_CMD_MARVELL_SET_TX_POWER
+	return vnd_conf.tx_power_policy != MRVL_TX_POWER_OFF;
+#else
+	return FALSE;
+#endif
+}
+
+void tx_power_mrvl_reset(void)
+{
+	pthread_mutex_lock(&tx_lock);
+	memset(links, 0, sizeof(links));
+	memset(le_handles, 0xFF, sizeof(le_handles));
+	cur_valid = change_pending = FALSE;
+	raised = lowered = limited = failed = 0;
+	dbm_ms = 0;
+	total_ms = 0;
+	pthread_mutex_unlock(&tx_lock);
+}
+
+/* Level to set once the controller has been reset; FALSE for none */
+int tx_power_mrvl_initial(int8_t *p_dbm)
+{
+	if (!tx_power_mrvl_needed())
+		return FALSE;
+
+	*p_dbm = (int8_t) clamp_dbm(vnd_conf.tx_power_dbm);
+	pthread_mutex_lock(&tx_lock);
+	change_pending = TRUE;
+	pthread_mutex_unlock(&tx_lock);
+	ALOGI("TX power %d dBm (%s)", *p_dbm,
+		vnd_conf.tx_power_policy == MRVL_TX_POWER_ADAPTIVE ?
+		"adaptive" : "fixed");
+	return TRUE;
+}
+
+/* Result of a level change, from either command path */
+void tx_power_mrvl_applied(int8_t dbm, int ok)
+{
+	uint32_t now = now_ms();
+
+	pthread_mutex_lock(&tx_lock);
+	change_pending = FALSE;
+	if (!ok) {
+		failed++;
+	} else {
+		level_account(now);
+		if (cur_valid && dbm > cur_dbm)
+			raised++;
+		else if (cur_valid && dbm < cur_dbm)
+			lowered++;
+		cur_dbm = dbm;
+		cur_valid = TRUE;
+		last_change_ms = now;
+	}
+	pthread_mutex_unlock(&tx_lock);
+}
+
+/*
+ * A link RSSI sample as returned by HCI_Read_RSSI: dBm on LE links, the
+ * offset from the Golden Receive Power Range on BR/EDR ones. One step
+ * per TxPowerMinIntervalMs at most, so the stack's own power control
+ * and ours do not chase each other.
+ */
+void tx_power_mrvl_rssi(uint16_t handle, int8_t rssi)
+{
+	uint32_t now = now_ms();
+	int slot = -1;
+	int level;
+	int next;
+	int i;
+
+	if (!tx_power_mrvl_needed() ||
+			vnd_conf.tx_power_policy != MRVL_TX_POWER_ADAPTIVE)
+		return;
+
+	pthread_mutex_lock(&tx_lock);
+	for (i = 0; i < MAX_RSSI_LINKS; i++) {
+		if (links[i].ms && links[i].handle == handle) {
+			slot = i;
+			break;
+		}
+		if (slot < 0 && (!links[i].ms ||
+				now - links[i].ms > RSSI_MAX_AGE_MS))
+			slot = i;
+	}
+	if (slot < 0) {
+		pthread_mutex_unlock(&tx_lock);
+		return;
+	}
+	links[slot].handle = handle;
+	links[slot].rssi = rssi;
+	links[slot].le = le_link(handle);
+	links[slot].ms = now ? now : 1;
+
+	if (!cur_valid || change_pending) {
+		pthread_mutex_unlock(&tx_lock);
+		return;
+	}
+
+	level = links_level(now);
+	next = cur_dbm;
+	if (level < 0)
+		next = clamp_dbm(cur_dbm + (int) vnd_conf.tx_power_step_db);
+	else if (level > 0)
+		next = clamp_dbm(cur_dbm - (int) vnd_conf.tx_power_step_db);
+
+	if (next == cur_dbm) {
+		pthread_mutex_unlock(&tx_lock);
+		return;
+	}
+	if (now - last_change_ms < vnd_conf.tx_power_min_interval_ms) {
+		limited++;
+		pthread_mutex_unlock(&tx_lock);
+		return;
+	}
+	change_pending = TRUE;
+	pthread_mutex_unlock(&tx_lock);
+
+	ALOGD("TX power %d -> %d dBm, link 0x%03X %s %d", cur_dbm, next,
+		handle, links[slot].le ? "rssi" : "golden range offset", rssi);
+#ifdef HCI_CMD_MARVELL_SET_TX_POWER
+	sent_dbm = (int8_t) next;
+	if (transport_mrvl_send_cmd(HCI_CMD_MARVELL_SET_TX_POWER,
+			(const uint8_t *) &sent_dbm, 1, tx_power_cmd_done) < 0)
+#endif
+		tx_power_mrvl_applied((int8_t) next, FALSE);
+}
+
+void tx_power_mrvl_link_down(uint16_t handle)
+{
+	int i;
+
+	pthread_mutex_lock(&tx_lock);
+	for (i = 0; i < MAX_RSSI_LINKS; i++) {
+		if (links[i].ms && links[i].handle == handle)
+			links[i].ms = 0;
+		if (le_handles[i] == handle)
+			le_handles[i] = 0xFFFF;
+	}
+	pthread_mutex_unlock(&tx_lock);
+}
+
+/* An LE link came up; its RSSI samples are in dBm */
+void tx_power_mrvl_le_link_up(uint16_t handle)
+{
+	int i;
+
+	pthread_mutex_lock(&tx_lock);
+	if (!le_link(handle)) {
+		for (i = 0; i < MAX_RSSI_LINKS; i++) {
+			if (le_handles[i] == 0xFFFF) {
+				le_handles[i] = handle;
+				break;
+			}
+		}
+	}
+	pthread_mutex_unlock(&tx_lock);
+}
+
+void tx_power_mrvl_dump_stats(void)
+{
+	pthread_mutex_lock(&tx_lock);
+	if (cur_valid) {
+		level_account(now_ms());
+		ALOGI("TX power %d dBm, %u raised %u lowered, %u rate limited, "
+			"%u failed, average %d dBm", cur_dbm, raised, lowered,
+			limited, failed,
+			total_ms ? (int) (dbm_ms / total_ms) : cur_dbm);
+	}
+	pthread_mutex_unlock(&tx_lock);
+}
@@ -0,0 +1,305 @@
+/******************************************************************************
+ *
+ *  Copyright (C) 2012 Marvell International Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at:
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+/******************************************************************************
+ *
+ *  Filename:      userial_mrvl.c
+ *
+ *  Description:   UART (H4) transport for UART attached Marvell controllers
+ *
+ ******************************************************************************/
+
+#define LOG_TAG "bt_mrvl"
+
+#include <utils/Log.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bt_vendor_mrvl.h"
+
+#define HCI_EVT_CMD_COMPLETE 0x0E
+
+/* First probe retry delay, doubled after each miss */
+#define PROBE_BACKOFF_MS     10
+
+/***********************************************************
+ *  Local functions
+ ***********************************************************
+ */
+static uint32_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t) (ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+/*
+ * Wait until deadline for the Command Complete of Read Local Version.
+ * Anything else the controller sends before the stack is up is dropped.
+ */
+static int probe_wait(int fd, uint32_t deadline)
+{
+	struct pollfd pfd;
+	uint8_t buf[260];
+	int len = 0;
+	int pkt;
+	int left;
+	int n;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	while ((left = (int) (deadline - now_ms())) > 0) {
+		if (poll(&pfd, 1, left) <= 0)
+			continue;
+
+		n = read(fd, buf + len, sizeof(buf) - len);
+		if (n <= 0) {
+			if (n < 0 && (errno == EINTR || errno == EAGAIN))
+				continue;
+			return -1;
+		}
+		len += n;
+
+		while (len >= 3) {
+			if (buf[0] != H4_TYPE_EVT) {
+				/* Not an event start, resync on next byte */
+				memmove(buf, buf + 1, --len);
+				continue;
+			}
+			pkt = 3 + buf[2];
+			if (len < pkt)
+				break;
+			if (buf[1] == HCI_EVT_CMD_COMPLETE && pkt >= 6 &&
+					buf[4] == 0x01 && buf[5] == 0x10)
+				return 0;
+			len -= pkt;
+			memmove(buf, buf + pkt, len);
+		}
+
+		if (len == sizeof(buf))
+			len = 0;
+	}
+
+	return -1;
+}
+/*
+ * Throw away whatever the controller sends within wait_ms; 0 only takes
+ * what is already queued. Works on mbtchar too, where tcflush does not.
+ */
+static void probe_drain(int fd, uint32_t wait_ms)
+{
+	uint32_t deadline = now_ms() + wait_ms;
+	struct pollfd pfd;
+	uint8_t buf[260];
+	int left;
+	int n;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	do {
+		left = (int) (deadline - now_ms());
+		if (left < 0)
+			left = 0;
+		n = poll(&pfd, 1, left);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		n = read(fd, buf, sizeof(buf));
+	} while (n > 0 || (n < 0 && (errno == EINTR || errno == EAGAIN)));
+}
+
+static speed_t baud_to_speed(uint32_t baud)
+{
+	switch (baud) {
+	case 9600:
+		return B9600;
+	case 19200:
+		return B19200;
+	case 38400:
+		return B38400;
+	case 57600:
+		return B57600;
+	case 115200:
+		return B115200;
+	case 230400:
+		return B230400;
+	case 460800:
+		return B460800;
+	case 921600:
+		return B921600;
+	case 1000000:
+		return B1000000;
+	case 1500000:
+		return B1500000;
+	case 2000000:
+		return B2000000;
+	case 3000000:
+		return B3000000;
+	case 4000000:
+		return B4000000;
+	default:
+		break;
+	}
+
+	return B0;
+}
+
+/***********************************************************
+ *  Global functions
+ ***********************************************************
+ */
+int userial_mrvl_set_baud(int fd, uint32_t baud)
+{
+	struct termios ti;
+	speed_t speed = baud_to_speed(baud);
+
+	if (speed == B0) {
+		ALOGE("Unsupported baud rate %u", baud);
+		return -1;
+	}
+
+	if (tcgetattr(fd, &ti) < 0) {
+		ALOGE("tcgetattr failed: %s", strerror(errno));
+		return -1;
+	}
+
+	cfsetospeed(&ti, speed);
+	cfsetispeed(&ti, speed);
+
+	if (tcsetattr(fd, TCSADRAIN, &ti) < 0) {
+		ALOGE("tcsetattr failed: %s", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+int userial_mrvl_open_uart(const char *port, uint32_t baud, int flow_ctl)
+{
+	struct termios ti;
+	int fd;
+
+	fd = open(port, O_RDWR | O_NOCTTY);
+	if (fd < 0) {
+		ALOGE("Fail to open uart %s: %s", port, strerror(errno));
+		return -1;
+	}
+
+	tcflush(fd, TCIOFLUSH);
+
+	if (tcgetattr(fd, &ti) < 0) {
+		ALOGE("tcgetattr failed: %s", strerror(errno));
+		goto fail;
+	}
+
+	cfmakeraw(&ti);
+	ti.c_cflag |= CLOCAL | CREAD;
+	if (flow_ctl)
+		ti.c_cflag |= CRTSCTS;
+	else
+		ti.c_cflag &= ~CRTSCTS;
+	ti.c_cc[VMIN] = 1;
+	ti.c_cc[VTIME] = 0;
+
+	if (tcsetattr(fd, TCSANOW, &ti) < 0) {
+		ALOGE("tcsetattr failed: %s", strerror(errno));
+		goto fail;
+	}
+
+	if (userial_mrvl_set_baud(fd, baud) < 0)
+		goto fail;
+
+	tcflush(fd, TCIOFLUSH);
+
+	ALOGI("uart %s opened at %u baud, flow control %s", port, baud,
+		flow_ctl ? "on" : "off");
+	return fd;
+
+fail:
+	close(fd);
+	return -1;
+}
+
+/* One Read Local Version; 0 if the controller answered within timeout_ms */
+int userial_mrvl_ping(int fd, uint32_t timeout_ms)
+{
+	static const uint8_t read_version[] = { 0x01, 0x01, 0x10, 0x00 };
+
+	if (write(fd, read_version, sizeof(read_version)) !=
+			sizeof(read_version))
+		return -1;
+
+	return probe_wait(fd, now_ms() + timeout_ms);
+}
+
+/*
+ * Check that the controller behind fd answers HCI before the stack is
+ * handed the port. Each attempt sends Read Local Version and waits
+ * timeout_ms for it; misses are retried with growing backoff until
+ * budget_ms is spent. Returns 0 when the controller answered.
+ *
+ * A slow controller may answer a missed attempt late, and the answers
+ * look alike: input is flushed before each attempt, and after a retried
+ * success the answers still owed are drained so the stack never sees a
+ * Command Complete it did not ask for.
+ */
+int userial_mrvl_probe(int fd, uint32_t timeout_ms, uint32_t budget_ms,
+		uint32_t *p_attempts, uint32_t *p_latency_ms)
+{
+	uint32_t start = now_ms();
+	uint32_t backoff = PROBE_BACKOFF_MS;
+	uint32_t attempts = 0;
+	int ret = -1;
+
+	do {
+		attempts++;
+		probe_drain(fd, 0);
+		if (userial_mrvl_ping(fd, timeout_ms) == 0) {
+			if (attempts > 1)
+				probe_drain(fd, timeout_ms);
+			ret = 0;
+			break;
+		}
+
+		if (now_ms() - start + backoff >= budget_ms)
+			break;
+		usleep(backoff * 1000);
+		backoff *= 2;
+	} while (1);
+
+	*p_attempts = attempts;
+	*p_latency_ms = now_ms() - start;
+
+	if (ret)
+		ALOGE("Controller not responding after %u probes, %u ms",
+			attempts, *p_latency_ms);
+	else
+		ALOGI("Controller ready after %u probe(s), %u ms", attempts,
+			*p_latency_ms);
+
+	return ret;
+}
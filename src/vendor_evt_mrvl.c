@@ -0,0 +1,185 @@
+/******************************************************************************
+ *
+ *  Copyright (C) 2012 Marvell International Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at:
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+/******************************************************************************
+ *
+ *  Filename:      vendor_evt_mrvl.c
+ *
+ *  Description:   Tracks Marvell vendor specific (0xFF) events seen by the
+ *                 relay: controller power state changes and firmware
+ *                 faults. The events still go on to the stack unchanged.
+ *                 Power state reports are checked against the host's
+ *                 LPM wake line.
+ *
+ ******************************************************************************/
+
+#define LOG_TAG "bt_mrvl"
+
+#include <utils/Log.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+#include "bt_vendor_mrvl.h"
+
+#define HCI_EVT_VENDOR               0xFF
+
+/* First parameter byte of a Marvell vendor event */
+#define MRVL_EVT_POWER_STATE         0x20
+#define MRVL_EVT_AUTO_SLEEP_MODE     0x23
+#define MRVL_EVT_HOST_SLEEP_CONFIG   0x59
+#define MRVL_EVT_HOST_SLEEP_ENABLE   0x5A
+
+/* MRVL_EVT_POWER_STATE parameter */
+#define MRVL_PS_SLEEP                0x01
+#define MRVL_PS_AWAKE                0x02
+
+/***********************************************************
+ *  Local variables
+ ***********************************************************
+ */
+static int ctrl_sleeping;
+static uint32_t sleep_count;
+static uint32_t wake_count;
+static uint32_t fault_count;
+static uint8_t last_fault;
+
+/* LPM state: relay thread for the events, stack thread for the wake line */
+static pthread_mutex_t lpm_lock = PTHREAD_MUTEX_INITIALIZER;
+static int host_wake;              /* host holds the controller awake */
+static uint64_t wake_assert_ns;    /* asserted while asleep, not answered */
+static uint32_t lpm_mismatch;
+static uint32_t wake_max_us;
+
+/***********************************************************
+ *  Local functions
+ ***********************************************************
+ */
+static uint64_t evt_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Controller power state report against the wake line */
+static void lpm_check(int sleeping)
+{
+	uint32_t us;
+
+	pthread_mutex_lock(&lpm_lock);
+	ctrl_sleeping = sleeping;
+	if (sleeping) {
+		sleep_count++;
+		if (host_wake) {
+			lpm_mismatch++;
+			ALOGW("LPM: controller went to sleep with wake asserted");
+		}
+	} else {
+		wake_count++;
+		if (wake_assert_ns) {
+			us = (uint32_t) ((evt_now_ns() - wake_assert_ns) / 1000);
+			if (us > wake_max_us)
+				wake_max_us = us;
+			wake_assert_ns = 0;
+		}
+	}
+	pthread_mutex_unlock(&lpm_lock);
+}
+
+/***********************************************************
+ *  Global functions
+ ***********************************************************
+ */
+void vendor_evt_mrvl_reset(void)
+{
+	pthread_mutex_lock(&lpm_lock);
+	ctrl_sleeping = FALSE;
+	sleep_count = wake_count = fault_count = 0;
+	last_fault = 0;
+	wake_assert_ns = 0;
+	lpm_mismatch = wake_max_us = 0;
+	pthread_mutex_unlock(&lpm_lock);
+}
+
+/* p is a complete H4 event; only vendor events are looked at */
+void vendor_evt_mrvl_tap(const uint8_t *p, int len)
+{
+	if (p[1] != HCI_EVT_VENDOR || len < 4)
+		return;
+
+	switch (p[3]) {
+	case MRVL_EVT_POWER_STATE:
+		if (len < 5)
+			break;
+		if (p[4] == MRVL_PS_SLEEP)
+			lpm_check(TRUE);
+		else if (p[4] == MRVL_PS_AWAKE)
+			lpm_check(FALSE);
+		break;
+
+	case MRVL_EVT_AUTO_SLEEP_MODE:
+	case MRVL_EVT_HOST_SLEEP_CONFIG:
+	case MRVL_EVT_HOST_SLEEP_ENABLE:
+		ALOGD("vendor event 0x%02X status 0x%02X", p[3],
+			len > 4 ? p[4] : 0);
+		break;
+
+	default:
+		if (vnd_conf.vendor_fault_evt && p[3] == vnd_conf.vendor_fault_evt) {
+			fault_count++;
+			last_fault = len > 4 ? p[4] : 0;
+			ALOGE("controller fault event, code 0x%02X (%u so far)",
+				last_fault, fault_count);
+			hw_mrvl_controller_fault(last_fault);
+		}
+		break;
+	}
+}
+
+/*
+ * Host LPM wake line, from BT_VND_OP_LPM_WAKE_SET_STATE. Asserting it
+ * over a sleeping controller must bring a wake report before it is
+ * released again.
+ */
+void vendor_evt_mrvl_host_wake(int asserted)
+{
+	pthread_mutex_lock(&lpm_lock);
+	if (asserted && !host_wake && ctrl_sleeping) {
+		wake_assert_ns = evt_now_ns();
+	} else if (!asserted && wake_assert_ns) {
+		lpm_mismatch++;
+		wake_assert_ns = 0;
+		ALOGW("LPM: wake released, controller never reported awake");
+	}
+	host_wake = asserted;
+	pthread_mutex_unlock(&lpm_lock);
+}
+
+void vendor_evt_mrvl_dump_stats(void)
+{
+	pthread_mutex_lock(&lpm_lock);
+	if (sleep_count || wake_count || fault_count)
+		ALOGI("controller power: %s, %u sleeps %u wakes, %u faults "
+			"(last 0x%02X), %u LPM mismatches, wake max %u us",
+			ctrl_sleeping ? "asleep" : "awake", sleep_count,
+			wake_count, fault_count, last_fault, lpm_mismatch,
+			wake_max_us);
+	pthread_mutex_unlock(&lpm_lock);
+}
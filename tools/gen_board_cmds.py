@@ -0,0 +1,150 @@
+#!/usr/bin/env python
+#
+#  Copyright (C) 2012 Marvell International Ltd.
+#
+#  Licensed under the Apache License, Version 2.0 (the "License");
+#  you may not use this file except in compliance with the License.
+#  You may obtain a copy of the License at:
+#
+#  http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+#
+"""Turn a board profile into mrvl_board_cmds.h.
+
+The profile uses the bt_vendor.conf syntax (Name = Value, # comments):
+
+  BdAddress     stack, or a fixed aa:bb:cc:dd:ee:ff
+  ScoDataPath   pcm or hci
+  PcmRole       master or slave
+  PcmSyncMode   PCM sync mode byte
+  PcmSyncCfg    PCM sync config byte
+  PcmClockRate  PCM clock rate byte
+  PcmSlot       PCM slot, 16 bit
+
+Each vendor command the lib sends during FW and SCO config comes out as a
+ready image: opcode (little endian), parameter length, parameters.
+
+usage: gen_board_cmds.py <profile> <header>
+"""
+
+import os
+import sys
+
+OPCODES = {
+    "write_pcm_settings": 0xFC07,
+    "write_pcm_sync_settings": 0xFC28,
+    "write_pcm_link_settings": 0xFC29,
+    "set_sco_data_path": 0xFC1D,
+    "write_bd_address": 0xFC22,
+}
+
+DEFAULTS = {
+    "BdAddress": "stack",
+    "ScoDataPath": "pcm",
+    "PcmRole": "master",
+    "PcmSyncMode": "0x03",
+    "PcmSyncCfg": "0x00",
+    "PcmClockRate": "0x03",
+    "PcmSlot": "0x0003",
+}
+
+
+def fail(msg):
+    sys.stderr.write("gen_board_cmds: %s\n" % msg)
+    sys.exit(1)
+
+
+def parse(path):
+    conf = dict(DEFAULTS)
+    with open(path) as f:
+        for num, line in enumerate(f, 1):
+            line = line.split("#", 1)[0].strip()
+            if not line:
+                continue
+            if "=" not in line:
+                fail("%s:%d: expected Name = Value" % (path, num))
+            name, value = [s.strip() for s in line.split("=", 1)]
+            if name not in DEFAULTS:
+                fail("%s:%d: unknown name %s" % (path, num, name))
+            conf[name] = value
+    return conf
+
+
+def byte(conf, name, bits=8):
+    try:
+        val = int(conf[name], 0)
+    except ValueError:
+        fail("%s: not a number: %s" % (name, conf[name]))
+    if val < 0 or val >= 1 << bits:
+        fail("%s: out of range: %s" % (name, conf[name]))
+    return val
+
+
+def choice(conf, name, values):
+    val = conf[name].lower()
+    if val not in values:
+        fail("%s: expected one of %s" % (name, ", ".join(sorted(values))))
+    return values[val]
+
+
+def image(name, params):
+    op = OPCODES[name]
+    return [op & 0xFF, op >> 8, len(params)] + params
+
+
+def main():
+    if len(sys.argv) != 3:
+        fail("usage: gen_board_cmds.py <profile> <header>")
+
+    conf = parse(sys.argv[1])
+    cmds = []
+
+    role = choice(conf, "PcmRole", {"master": 0x02, "slave": 0x00})
+    slot = byte(conf, "PcmSlot", 16)
+    cmds.append(("write_pcm_settings", [role]))
+    cmds.append(("write_pcm_sync_settings", [byte(conf, "PcmSyncMode"),
+                 byte(conf, "PcmSyncCfg"), byte(conf, "PcmClockRate")]))
+    cmds.append(("write_pcm_link_settings", [slot & 0xFF, slot >> 8]))
+    sco_path = choice(conf, "ScoDataPath", {"hci": 0x00, "pcm": 0x01})
+    cmds.append(("set_sco_data_path", [sco_path]))
+
+    bd_addr = conf["BdAddress"].lower()
+    if bd_addr != "stack":
+        try:
+            addr = [int(b, 16) for b in bd_addr.split(":")]
+        except ValueError:
+            addr = []
+        if len(addr) != 6 or max(addr) > 0xFF:
+            fail("BdAddress: expected stack or aa:bb:cc:dd:ee:ff")
+        # Parameter ID, length, address LSB first
+        cmds.append(("write_bd_address", [0xFE, 0x06] + addr[::-1]))
+
+    out = []
+    out.append("/* Generated by gen_board_cmds.py from %s, do not edit */"
+               % os.path.basename(sys.argv[1]))
+    out.append("#ifndef MRVL_BOARD_CMDS_H")
+    out.append("#define MRVL_BOARD_CMDS_H")
+    out.append("")
+    out.append("#define MRVL_BOARD_SCO_DATA_PATH 0x%02X" % sco_path)
+    if bd_addr != "stack":
+        out.append("#define MRVL_BOARD_BD_ADDRESS")
+    out.append("")
+    for name, params in cmds:
+        img = ", ".join("0x%02X" % b for b in image(name, params))
+        out.append("static const uint8_t board_cmd_%s[] = {" % name)
+        out.append("\t%s" % img)
+        out.append("};")
+        out.append("")
+    out.append("#endif /* MRVL_BOARD_CMDS_H */")
+
+    with open(sys.argv[2], "w") as f:
+        f.write("\n".join(out) + "\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,171 @@
+/******************************************************************************
+ *
+ *  Copyright (C) 2012 Marvell International Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at:
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+/******************************************************************************
+ *
+ *  Filename:      mrvl_bt_fdkeeper.c
+ *
+ *  Description:   Holds the Bluetooth controller port open while the
+ *                 Bluetooth process runs, so a restarted process can take
+ *                 over a configured controller. Run it as the bluetooth
+ *                 user; only peers with the same uid are served.
+ *
+ ******************************************************************************/
+
+#define LOG_TAG "bt_fdkeeper"
+
+#include <utils/Log.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "mrvl_fd_handoff.h"
+
+static int kept_fd = -1;
+static int kept_healthy;
+
+static void drop_kept(void)
+{
+	if (kept_fd >= 0)
+		close(kept_fd);
+	kept_fd = -1;
+	kept_healthy = 0;
+}
+
+static void serve(int sk)
+{
+	char ctrl[CMSG_SPACE(sizeof(int))];
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	struct ucred cred;
+	socklen_t cred_len = sizeof(cred);
+	uint8_t op;
+	uint8_t status;
+	int fd = -1;
+
+	if (getsockopt(sk, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) < 0 ||
+			cred.uid != getuid()) {
+		ALOGW("rejecting peer pid %d", cred.pid);
+		return;
+	}
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &op;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctrl;
+	msg.msg_controllen = sizeof(ctrl);
+
+	if (recvmsg(sk, &msg, MSG_CMSG_CLOEXEC) != 1)
+		return;
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg && cmsg->cmsg_level == SOL_SOCKET &&
+			cmsg->cmsg_type == SCM_RIGHTS)
+		memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+
+	switch (op) {
+	case FD_OP_PUT:
+		drop_kept();
+		kept_fd = fd;
+		fd = -1;
+		ALOGI("keeping port fd from pid %d", cred.pid);
+		break;
+
+	case FD_OP_HEALTHY:
+		kept_healthy = kept_fd >= 0;
+		break;
+
+	case FD_OP_GET:
+		memset(&msg, 0, sizeof(msg));
+		status = kept_healthy ? FD_HEALTHY : FD_NONE;
+		iov.iov_base = &status;
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		if (kept_healthy) {
+			msg.msg_control = ctrl;
+			msg.msg_controllen = sizeof(ctrl);
+			cmsg = CMSG_FIRSTHDR(&msg);
+			cmsg->cmsg_level = SOL_SOCKET;
+			cmsg->cmsg_type = SCM_RIGHTS;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+			memcpy(CMSG_DATA(cmsg), &kept_fd, sizeof(int));
+			ALOGI("handing port over to pid %d", cred.pid);
+		}
+		sendmsg(sk, &msg, 0);
+		break;
+
+	case FD_OP_DROP:
+		ALOGI("port released by pid %d", cred.pid);
+		drop_kept();
+		break;
+
+	default:
+		ALOGW("unknown op 0x%02X", op);
+		break;
+	}
+
+	if (fd >= 0)
+		close(fd);
+}
+
+int main(void)
+{
+	struct sockaddr_un addr;
+	socklen_t len;
+	int lsk, sk;
+
+	lsk = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (lsk < 0) {
+		ALOGE("socket: %s", strerror(errno));
+		return 1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strlcpy(addr.sun_path + 1, MRVL_FD_KEEPER_SOCKET,
+		sizeof(addr.sun_path) - 1);
+	len = offsetof(struct sockaddr_un, sun_path) + 1 +
+		strlen(MRVL_FD_KEEPER_SOCKET);
+
+	if (bind(lsk, (struct sockaddr *) &addr, len) < 0 ||
+			listen(lsk, 4) < 0) {
+		ALOGE("bind/listen: %s", strerror(errno));
+		return 1;
+	}
+
+	for (;;) {
+		sk = accept4(lsk, NULL, NULL, SOCK_CLOEXEC);
+		if (sk < 0) {
+			if (errno == EINTR)
+				continue;
+			ALOGE("accept: %s", strerror(errno));
+			return 1;
+		}
+		serve(sk);
+		close(sk);
+	}
+
+	return 0;
+}
@@ -0,0 +1,83 @@
+/******************************************************************************
+ *
+ *  Copyright (C) 2012 Marvell International Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at:
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+/******************************************************************************
+ *
+ *  Filename:      mrvl_enable_dump.c
+ *
+ *  Description:   Prints the enable timing journal, oldest record first.
+ *
+ *  Usage:         mrvl_enable_dump [journal file]
+ *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mrvl_journal.h"
+
+static int rec_cmp(const void *a, const void *b)
+{
+	const struct mrvl_journal_rec *ra = a;
+	const struct mrvl_journal_rec *rb = b;
+
+	return ra->seq < rb->seq ? -1 : ra->seq > rb->seq;
+}
+
+int main(int argc, char **argv)
+{
+	const char *path = argc > 1 ? argv[1] : MRVL_JOURNAL_FILE;
+	struct mrvl_journal_rec recs[MRVL_JOURNAL_SLOTS];
+	struct mrvl_journal_rec rec;
+	char when[32];
+	time_t t;
+	FILE *f;
+	int n = 0;
+	int i;
+
+	f = fopen(path, "rb");
+	if (!f) {
+		perror(path);
+		return 1;
+	}
+
+	while (n < MRVL_JOURNAL_SLOTS && fread(&rec, sizeof(rec), 1, f) == 1)
+		if (mrvl_journal_valid(&rec))
+			recs[n++] = rec;
+	fclose(f);
+
+	qsort(recs, n, sizeof(recs[0]), rec_cmp);
+
+	printf("%6s %-19s %6s %6s %5s %6s %6s %5s %4s %s\n", "seq", "time",
+		"power", "open", "retry", "fwcfg", "total", "cpu", "fail",
+		"result");
+	for (i = 0; i < n; i++) {
+		t = recs[i].time;
+		strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S",
+			localtime(&t));
+		printf("%6u %-19s %6u %6u %5u %6u %6u %5u %4u %s\n",
+			recs[i].seq, when, recs[i].power_ms, recs[i].open_ms,
+			recs[i].open_retries, recs[i].fwcfg_ms,
+			recs[i].total_ms, recs[i].cpu_ms,
+			recs[i].cmd_failures, recs[i].result ? "FAIL" : "ok");
+	}
+
+	return 0;
+}
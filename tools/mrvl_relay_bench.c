@@ -0,0 +1,1695 @@
+/******************************************************************************
+ *
+ *  Copyright (C) 2012 Marvell International Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at:
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+/******************************************************************************
+ *
+ *  Filename:      mrvl_relay_bench.c
+ *
+ *  Description:   Host benchmark for the H4 relay. An emulated controller
+ *                 sits on one end of a socketpair, the bench plays the
+ *                 stack on the other, with and without the relay thread
+ *                 in between. Built with MRVL_RELAY_STATS so the relay
+ *                 also logs its own counters when it stops.
+ *
+ *                 The sco mode brings the whole lib up the way the stack
+ *                 does, against an emulated controller behind a pty, and
+ *                 times SCO frames through local loopback: once with SCO
+ *                 over HCI, then over PCM for each PCM profile, switched
+ *                 with BT_VND_OP_MRVL_SET_PCM_PROFILE. The PCM bus and
+ *                 the codec looping it back are a model (emu_pcm_ns), so
+ *                 the profiles compare against each other, not against
+ *                 real hardware.
+ *                 The adv mode feeds a crowded LE scan through the relay
+ *                 and reports the host CPU the advertising dedup saves.
+ *                 The nodes mode brings up 1, 2, 4 ... radios at once,
+ *                 one process and emulated node each as on a test
+ *                 station, and reports enable time, traffic time and
+ *                 CPU per radio against the single radio run.
+ *
+ *  Usage:         mrvl_relay_bench acl [payload sizes...]
+ *                 mrvl_relay_bench reset [iterations]
+ *                 mrvl_relay_bench sco [frames]
+ *                 mrvl_relay_bench adv [dedup window ms]
+ *                 mrvl_relay_bench nodes [max nodes]
+ *
+ ******************************************************************************/
+
+#define LOG_TAG "bt_mrvl_bench"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "bt_vendor_lib.h"
+#include "bt_hci_bdroid.h"
+#include "bt_vendor_mrvl.h"
+
+/* Bytes pushed each way per run */
+#define BENCH_BYTES          (32 * 1024 * 1024)
+
+#define H4_CMD               0x01
+#define H4_ACL               0x02
+#define H4_SCO               0x03
+#define H4_EVT               0x04
+
+#define HCI_EVT_CONN_COMPLETE        0x03
+#define HCI_EVT_DISCONN_COMPLETE     0x05
+#define HCI_EVT_CMD_COMPLETE         0x0E
+#define HCI_EVT_CMD_STATUS           0x0F
+#define HCI_EVT_NUM_COMPL_PKTS       0x13
+#define HCI_EVT_LE_META              0x3E
+
+#define HCI_LE_ADV_REPORT            0x02
+
+#define HCI_RESET                    0x0C03
+#define HCI_WRITE_LOOPBACK_MODE      0x1802
+#define HCI_LE_READ_LOCAL_FEATURES   0x2003
+
+/* Marvell commands whose settings the emulated controller keeps */
+#define HCI_CMD_MARVELL_WRITE_PCM_SETTINGS      0xFC07
+#define HCI_CMD_MARVELL_WRITE_PCM_SYNC_SETTINGS 0xFC28
+#define HCI_CMD_MARVELL_WRITE_PCM_LINK_SETTINGS 0xFC29
+#define HCI_CMD_MARVELL_SET_SCO_DATA_PATH       0xFC1D
+
+#define HCI_LOOPBACK_OFF             0x00
+#define HCI_LOOPBACK_LOCAL           0x01
+
+#define HCI_LINK_TYPE_SCO            0x00
+#define HCI_LINK_TYPE_ACL            0x01
+
+/* Links the emulated controller brings up in local loopback */
+#define EMU_ACL_HANDLE       0x0001
+#define EMU_SCO_HANDLE       0x0002
+
+/* UART the emulated controller pretends to sit behind */
+#define EMU_BAUD             3000000
+
+/* Packets the emulated controller holds back, and its idle poll */
+#define EMU_QUEUE_LEN        64
+#define EMU_IDLE_NS          10000000ULL
+
+/* Longest ACL payload the emulated controller loops back */
+#define EMU_ACL_MAX          1021
+
+/*
+ * Emulated PCM bus: 8 kHz frame sync, 16 bit slots carrying one 16 bit
+ * sample per frame, bit clock 128 kHz shifted up by the clock rate code.
+ */
+#define PCM_FRAME_NS         125000ULL
+#define PCM_SLOT_BITS        16
+#define PCM_BCLK_BASE_HZ     128000ULL
+#define PCM_ROLE_MASTER      0x02
+
+#define RESET_ITERATIONS     200
+
+/* SCO loopback: 64 kbit/s CVSD in 7.5 ms frames, link setup timeout */
+#define SCO_FRAME_LEN        60
+#define SCO_FRAME_US         7500
+#define SCO_FRAMES           400
+#define SCO_SETUP_MS         1000
+
+/* Longest the lib gets for a config chain or an open */
+#define LIB_STEP_MS          2000
+
+/* Nodes: radios per run up to the default, each with this ACL load */
+#define NODES_MAX            64
+#define NODE_ACL_PKTS        256
+#define NODE_ACL_LEN         1021
+#define NODE_ACL_WINDOW      8
+
+/* Advertising: a crowded scan, and the dedup window it is run with */
+#define ADV_REPORTS          20000
+#define ADV_DEVICES          64
+#define ADV_GAP_US           100
+#define ADV_WINDOW_MS        100
+
+/* Packet the emulated controller has yet to put on the wire */
+struct emu_pkt {
+	uint64_t due_ns;
+	int len;
+	uint8_t buf[5 + EMU_ACL_MAX];
+};
+
+/* Emulated controller, one thread on the far end of the port */
+struct bench_emu {
+	int fd;
+	pthread_t thread;
+	volatile int stop;
+	unsigned int cmds;
+	int loopback;
+	uint64_t cpu_ns;    /* thread CPU, once it has ended */
+	/* Set up by the lib's vendor commands */
+	uint8_t sco_path;
+	uint8_t pcm_role;
+	uint8_t pcm_clock;
+	uint16_t pcm_slot;
+	unsigned int pcm_dropped; /* frames the slot setup cannot carry */
+	/* Sent in order, each no earlier than its due time */
+	struct emu_pkt q[EMU_QUEUE_LEN];
+	unsigned int q_head;
+	unsigned int q_len;
+};
+
+/* A pty standing in for the mbtchar node, controller on the master */
+struct bench_node {
+	int master;
+	int slave;          /* held so the raw setup outlives lib closes */
+	char path[64];
+	struct bench_emu emu;
+};
+
+/* Host side of one SCO loopback run; the frame carries its index */
+struct bench_sco {
+	int loopback_cc;    /* Write Loopback Mode Command Completes */
+	int links;          /* loopback links up */
+	uint16_t sco_handle;
+	unsigned int stray; /* packets a host would not expect */
+	uint32_t sent;
+	uint32_t rcvd;
+	uint64_t *sent_ns;
+	uint32_t last_rtt_us;
+	uint32_t min_us;
+	uint32_t max_us;
+	uint64_t sum_us;
+	uint32_t jitter_us;
+};
+
+/* Stack side of the lib under test: the port and its vendor callbacks */
+struct bench_host {
+	int fd;             /* what USERIAL_OPEN handed over */
+	uint16_t lib_opcode; /* lib command waiting for its event, 0: none */
+	tINT_CMD_CBACK lib_cb;
+	unsigned int lib_cmds;
+	int cfg_result;     /* of FW_CFG or SCO_CFG, -1 while pending */
+	uint32_t acl_rcvd;
+	struct bench_sco sco;
+};
+
+/* What one node of the nodes mode reports back */
+struct node_result {
+	int ok;
+	uint64_t enable_us;     /* init to the end of FW config */
+	uint64_t traffic_us;
+	uint64_t cpu_us;        /* the node's process, emulator left out */
+	uint32_t lib_total_ms;  /* the lib's own enable timing */
+};
+
+struct bench_pump {
+	int fd;
+	int pkt_len;        /* H4 packet length, writers only */
+	size_t total;
+	uint64_t done_ns;
+	int err;
+};
+
+/* The vendor callbacks carry no context: one lib, one host */
+static struct bench_host host = { .fd = -1 };
+
+/* No wireless daemon on the host; the emulated controller is always up */
+int bluetooth_enable(void)
+{
+	return 0;
+}
+
+int bluetooth_disable(void)
+{
+	return 0;
+}
+
+static uint64_t bench_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t bench_cpu_us(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return (uint64_t) (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000 +
+		ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+static uint64_t bench_thread_cpu_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int read_full(int fd, uint8_t *buf, int len)
+{
+	ssize_t n;
+	int off;
+
+	for (off = 0; off < len; off += n) {
+		n = read(fd, buf + off, len - off);
+		if (n <= 0) {
+			if (n < 0 && errno == EINTR) {
+				n = 0;
+				continue;
+			}
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int write_full(int fd, const uint8_t *buf, int len)
+{
+	ssize_t n;
+	int off;
+
+	for (off = 0; off < len; off += n) {
+		n = write(fd, buf + off, len - off);
+		if (n < 0) {
+			if (errno == EINTR) {
+				n = 0;
+				continue;
+			}
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void bench_sleep_ns(uint64_t ns)
+{
+	struct timespec ts;
+
+	ts.tv_sec = (time_t) (ns / 1000000000ULL);
+	ts.tv_nsec = (long) (ns % 1000000000ULL);
+	nanosleep(&ts, NULL);
+}
+
+/* Time the given number of bytes spend on the modelled UART */
+static uint64_t emu_wire_ns(int bytes)
+{
+	return (uint64_t) bytes * 10 * 1000000000ULL / EMU_BAUD;
+}
+
+/* Put out what is due; with wait, sleep for the head if nothing is */
+static int emu_flush(struct bench_emu *emu, int wait)
+{
+	struct emu_pkt *p;
+	uint64_t now;
+
+	while (emu->q_len) {
+		p = &emu->q[emu->q_head];
+		now = bench_now_ns();
+		if (p->due_ns > now) {
+			if (!wait)
+				break;
+			bench_sleep_ns(p->due_ns - now);
+		}
+		wait = FALSE;
+		if (write_full(emu->fd, p->buf, p->len))
+			return -1;
+		emu->q_head = (emu->q_head + 1) % EMU_QUEUE_LEN;
+		emu->q_len--;
+	}
+	return 0;
+}
+
+/* Queue a packet for due_ns, never ahead of those queued before it */
+static int emu_send(struct bench_emu *emu, const uint8_t *pkt, int len,
+		uint64_t due_ns)
+{
+	struct emu_pkt *p;
+
+	if (emu->q_len == EMU_QUEUE_LEN && emu_flush(emu, TRUE))
+		return -1;
+
+	if (emu->q_len) {
+		p = &emu->q[(emu->q_head + emu->q_len - 1) % EMU_QUEUE_LEN];
+		if (due_ns < p->due_ns)
+			due_ns = p->due_ns;
+	}
+
+	p = &emu->q[(emu->q_head + emu->q_len) % EMU_QUEUE_LEN];
+	p->due_ns = due_ns;
+	p->len = len;
+	memcpy(p->buf, pkt, len);
+	emu->q_len++;
+	return 0;
+}
+
+/* Local loopback brings up one ACL and one SCO link, and drops them */
+static int emu_loopback(struct bench_emu *emu, uint8_t mode, uint64_t now)
+{
+	static const uint16_t handles[2] = { EMU_ACL_HANDLE, EMU_SCO_HANDLE };
+	uint8_t evt[3 + 11];
+	int i;
+
+	if (!mode == !emu->loopback)
+		return 0;
+	emu->loopback = mode;
+
+	for (i = 0; i < 2; i++) {
+		memset(evt, 0, sizeof(evt));
+		evt[0] = H4_EVT;
+		evt[4] = (uint8_t) handles[i];
+		evt[5] = (uint8_t) (handles[i] >> 8);
+		if (mode) {
+			evt[1] = HCI_EVT_CONN_COMPLETE;
+			evt[2] = 11;
+			evt[12] = i ? HCI_LINK_TYPE_SCO : HCI_LINK_TYPE_ACL;
+		} else {
+			evt[1] = HCI_EVT_DISCONN_COMPLETE;
+			evt[2] = 4;
+			evt[6] = 0x16;  /* terminated by local host */
+		}
+		if (emu_send(emu, evt, 3 + evt[2],
+				now + emu_wire_ns(3 + evt[2])))
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * Answer one HCI command with a Command Complete, keeping what the PCM,
+ * SCO path and loopback commands set up.
+ */
+static int emu_cmd(struct bench_emu *emu, const uint8_t *cmd)
+{
+	uint16_t opcode = cmd[1] | (cmd[2] << 8);
+	const uint8_t *param = cmd + 4;
+	int param_len = cmd[3];
+	uint8_t evt[3 + 4 + 8];
+	uint64_t due;
+	int len = 7;
+
+	evt[0] = H4_EVT;
+	evt[1] = HCI_EVT_CMD_COMPLETE;
+	evt[3] = 1;
+	evt[4] = (uint8_t) opcode;
+	evt[5] = (uint8_t) (opcode >> 8);
+	evt[6] = 0x00;
+
+	switch (opcode) {
+	case HCI_LE_READ_LOCAL_FEATURES:
+		/* Every LE feature, so each configured command goes out */
+		memset(evt + 7, 0xFF, 8);
+		len += 8;
+		break;
+	case HCI_CMD_MARVELL_WRITE_PCM_SETTINGS:
+		if (param_len >= 1)
+			emu->pcm_role = param[0];
+		break;
+	case HCI_CMD_MARVELL_WRITE_PCM_SYNC_SETTINGS:
+		if (param_len >= 3)
+			emu->pcm_clock = param[2];
+		break;
+	case HCI_CMD_MARVELL_WRITE_PCM_LINK_SETTINGS:
+		if (param_len >= 2)
+			emu->pcm_slot = param[0] | (param[1] << 8);
+		break;
+	case HCI_CMD_MARVELL_SET_SCO_DATA_PATH:
+		if (param_len >= 1)
+			emu->sco_path = param[0];
+		break;
+	default:
+		break;
+	}
+	evt[2] = (uint8_t) (len - 3);
+
+	emu->cmds++;
+	due = bench_now_ns() + emu_wire_ns(4 + param_len + len);
+	if (emu_send(emu, evt, len, due))
+		return -1;
+	if (opcode == HCI_WRITE_LOOPBACK_MODE && param_len)
+		return emu_loopback(emu, param[0], due);
+	return 0;
+}
+
+/*
+ * Modelled trip of a SCO frame out on the PCM bus and back from a codec
+ * looping it: wait for the frame sync (a slave follows the codec's,
+ * modelled half a frame out of phase with the controller's own), then
+ * for the slot at the bit clock the profile sets. From there a sample
+ * goes each way per frame, and the codec takes one more frame to turn
+ * it around. Returns 0 if the slot does not fit in the frame.
+ */
+static uint64_t emu_pcm_ns(const struct bench_emu *emu, uint64_t now,
+		int len)
+{
+	uint64_t bclk = PCM_BCLK_BASE_HZ << (emu->pcm_clock & 0x07);
+	uint64_t phase = emu->pcm_role == PCM_ROLE_MASTER ? 0 :
+		PCM_FRAME_NS / 2;
+	uint64_t sync;
+
+	if ((uint64_t) (emu->pcm_slot + 1) * PCM_SLOT_BITS * 1000000000ULL >
+			bclk * PCM_FRAME_NS)
+		return 0;
+
+	sync = (phase + PCM_FRAME_NS - now % PCM_FRAME_NS) % PCM_FRAME_NS;
+	return sync + (uint64_t) emu->pcm_slot * PCM_SLOT_BITS *
+		1000000000ULL / bclk +
+		(uint64_t) ((len + 1) / 2 + 1) * PCM_FRAME_NS;
+}
+
+/* Take one packet off the port; -1 once it is gone */
+static int emu_rx(struct bench_emu *emu, uint8_t *buf)
+{
+	uint64_t due, pcm;
+	int len;
+
+	if (read_full(emu->fd, buf, 1))
+		return -1;
+
+	switch (buf[0]) {
+	case H4_CMD:
+		if (read_full(emu->fd, buf + 1, 3) ||
+				read_full(emu->fd, buf + 4, buf[3]))
+			return -1;
+		return emu_cmd(emu, buf);
+	case H4_ACL:
+		if (read_full(emu->fd, buf + 1, 4))
+			return -1;
+		len = buf[3] | (buf[4] << 8);
+		if (read_full(emu->fd, buf + 5, len))
+			return -1;
+		if (!emu->loopback || len > EMU_ACL_MAX)
+			return 0;
+		/* In and back out on the modelled UART */
+		due = bench_now_ns() + 2 * emu_wire_ns(5 + len);
+		return emu_send(emu, buf, 5 + len, due);
+	case H4_SCO:
+		if (read_full(emu->fd, buf + 1, 3) ||
+				read_full(emu->fd, buf + 4, buf[3]))
+			return -1;
+		if (!emu->loopback)
+			return 0;
+		/* In on the modelled UART, round the SCO path, back out */
+		due = bench_now_ns() + emu_wire_ns(4 + buf[3]);
+		if (emu->sco_path == MRVL_SCO_PATH_PCM) {
+			pcm = emu_pcm_ns(emu, due, buf[3]);
+			if (!pcm) {
+				emu->pcm_dropped++;
+				return 0;
+			}
+			due += pcm;
+		}
+		return emu_send(emu, buf, 4 + buf[3],
+				due + emu_wire_ns(4 + buf[3]));
+	default:
+		fprintf(stderr, "emu: bad H4 type 0x%02x\n", buf[0]);
+		return -1;
+	}
+}
+
+static void *emu_thread(void *arg)
+{
+	struct bench_emu *emu = arg;
+	uint8_t buf[4 + 0xFFFF];
+	struct pollfd pfd;
+	struct timespec ts;
+	uint64_t wait_ns, now;
+	int n;
+
+	pfd.fd = emu->fd;
+	pfd.events = POLLIN;
+
+	while (!emu->stop) {
+		wait_ns = EMU_IDLE_NS;
+		if (emu->q_len) {
+			now = bench_now_ns();
+			if (emu->q[emu->q_head].due_ns <= now)
+				wait_ns = 0;
+			else if (emu->q[emu->q_head].due_ns - now < wait_ns)
+				wait_ns = emu->q[emu->q_head].due_ns - now;
+		}
+		ts.tv_sec = 0;
+		ts.tv_nsec = (long) wait_ns;
+
+		n = ppoll(&pfd, 1, &ts, NULL);
+		if (n < 0 && errno != EINTR)
+			break;
+		if (n > 0 && emu_rx(emu, buf))
+			break;
+		if (emu_flush(emu, FALSE))
+			break;
+	}
+	emu->cpu_ns = bench_thread_cpu_ns();
+	return NULL;
+}
+
+static int emu_start(struct bench_emu *emu, int fd)
+{
+	memset(emu, 0, sizeof(*emu));
+	emu->fd = fd;
+	emu->sco_path = MRVL_SCO_PATH_HCI;
+	emu->pcm_role = PCM_ROLE_MASTER;
+	return pthread_create(&emu->thread, NULL, emu_thread, emu);
+}
+
+/* Wait for the Command Complete of opcode, skipping other events */
+static int host_wait_cc(int fd, uint16_t opcode)
+{
+	uint8_t evt[3 + 255];
+
+	for (;;) {
+		if (read_full(fd, evt, 3) || read_full(fd, evt + 3, evt[2]))
+			return -1;
+		if (evt[0] != H4_EVT)
+			continue;
+		if (evt[1] == HCI_EVT_CMD_COMPLETE && evt[2] >= 3 &&
+				(evt[4] | (evt[5] << 8)) == opcode)
+			return 0;
+	}
+}
+
+static void *bench_writer(void *arg)
+{
+	struct bench_pump *p = arg;
+	uint8_t pkt[1 + 4 + 0xFFFF];
+	size_t sent;
+
+	pkt[0] = H4_ACL;
+	pkt[1] = 0x01;
+	pkt[2] = 0x00;
+	pkt[3] = (uint8_t) (p->pkt_len - 5);
+	pkt[4] = (uint8_t) ((p->pkt_len - 5) >> 8);
+	memset(pkt + 5, 0xA5, p->pkt_len - 5);
+
+	for (sent = 0; sent < p->total; sent += p->pkt_len) {
+		if (write_full(p->fd, pkt, p->pkt_len)) {
+			p->err = errno;
+			return NULL;
+		}
+	}
+	p->done_ns = bench_now_ns();
+	return NULL;
+}
+
+static void *bench_reader(void *arg)
+{
+	struct bench_pump *p = arg;
+	uint8_t buf[16384];
+	size_t got = 0;
+	ssize_t n;
+
+	while (got < p->total) {
+		n = read(p->fd, buf, sizeof(buf));
+		if (n <= 0) {
+			if (n < 0 && errno == EINTR)
+				continue;
+			p->err = n ? errno : EPIPE;
+			return NULL;
+		}
+		got += n;
+	}
+	p->done_ns = bench_now_ns();
+	return NULL;
+}
+
+/*
+ * One run: payload-sized ACL both ways at once, host <-> controller,
+ * directly or through the relay. Returns 0 and prints a line on success.
+ */
+static int bench_acl_run(int payload, int relay)
+{
+	struct bench_pump host_tx, host_rx, ctl_tx, ctl_rx;
+	pthread_t th[4];
+	uint64_t start_ns, cpu_us;
+	size_t total;
+	int sp[2];
+	int host_fd;
+	int pkt_len = 5 + payload;
+	int i;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sp) < 0) {
+		perror("socketpair");
+		return -1;
+	}
+
+	if (relay) {
+		host_fd = transport_mrvl_start(sp[0]);
+		if (host_fd < 0) {
+			close(sp[0]);
+			close(sp[1]);
+			return -1;
+		}
+	} else {
+		host_fd = sp[0];
+	}
+
+	/* Whole packets only, so both readers know where to stop */
+	total = BENCH_BYTES / pkt_len * pkt_len;
+
+	memset(&host_tx, 0, sizeof(host_tx));
+	host_tx.fd = host_fd;
+	host_tx.pkt_len = pkt_len;
+	host_tx.total = total;
+	ctl_tx = host_tx;
+	ctl_tx.fd = sp[1];
+	host_rx = host_tx;
+	ctl_rx = ctl_tx;
+
+	start_ns = bench_now_ns();
+	cpu_us = bench_cpu_us();
+	pthread_create(&th[0], NULL, bench_reader, &host_rx);
+	pthread_create(&th[1], NULL, bench_reader, &ctl_rx);
+	pthread_create(&th[2], NULL, bench_writer, &host_tx);
+	pthread_create(&th[3], NULL, bench_writer, &ctl_tx);
+	for (i = 0; i < 4; i++)
+		pthread_join(th[i], NULL);
+	cpu_us = bench_cpu_us() - cpu_us;
+
+	if (relay)
+		transport_mrvl_stop();
+	close(sp[0]);
+	close(sp[1]);
+
+	if (host_rx.err || ctl_rx.err || host_tx.err || ctl_tx.err) {
+		fprintf(stderr, "acl %d: transfer failed: %s\n", payload,
+			strerror(host_rx.err ? host_rx.err : ctl_rx.err ?
+				ctl_rx.err : host_tx.err ? host_tx.err :
+				ctl_tx.err));
+		return -1;
+	}
+
+	/* rx is controller to host, tx host to controller */
+	printf("%-6s %5d  rx %7.1f MB/s  tx %7.1f MB/s  cpu %6llu us/MB\n",
+		relay ? "relay" : "raw", payload,
+		(double) total / (host_rx.done_ns - start_ns) * 1000000000.0 /
+			(1024 * 1024),
+		(double) total / (ctl_rx.done_ns - start_ns) * 1000000000.0 /
+			(1024 * 1024),
+		(unsigned long long) (cpu_us * 1024 * 1024 / (2 * total)));
+	return 0;
+}
+
+static int bench_acl(int argc, char **argv)
+{
+	static const int def_sizes[] = { 27, 251, 1021 };
+	int payload;
+	int i, n;
+
+	vnd_conf.transport_relay = TRUE;
+
+	printf("path   bytes  per direction, %d MB each way\n",
+		BENCH_BYTES / (1024 * 1024));
+
+	n = argc ? argc : (int) (sizeof(def_sizes) / sizeof(def_sizes[0]));
+	for (i = 0; i < n; i++) {
+		payload = argc ? atoi(argv[i]) : def_sizes[i];
+		if (payload <= 0 || payload > 0xFFFF) {
+			fprintf(stderr, "bad payload size %s\n", argv[i]);
+			return 1;
+		}
+		if (bench_acl_run(payload, FALSE) || bench_acl_run(payload, TRUE))
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Stack's HCI_Reset round trip through the relay; with LE defaults set
+ * the relay runs the post-reset sequence before it hands the Command
+ * Complete over. Returns the average round trip in us, -1 on error.
+ */
+static int bench_reset_run(const char *label, int iterations)
+{
+	static const uint8_t reset[] = { H4_CMD, 0x03, 0x0C, 0x00 };
+	struct bench_emu emu;
+	uint64_t t, sum_us = 0, max_us = 0;
+	int sp[2];
+	int host_fd;
+	int i;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sp) < 0) {
+		perror("socketpair");
+		return -1;
+	}
+
+	host_fd = transport_mrvl_start(sp[0]);
+	if (host_fd < 0 || emu_start(&emu, sp[1])) {
+		transport_mrvl_stop();
+		close(sp[0]);
+		close(sp[1]);
+		return -1;
+	}
+
+	for (i = 0; i < iterations; i++) {
+		t = bench_now_ns();
+		if (write_full(host_fd, reset, sizeof(reset)) ||
+				host_wait_cc(host_fd, HCI_RESET)) {
+			fprintf(stderr, "reset %s: no Command Complete\n", label);
+			break;
+		}
+		t = (bench_now_ns() - t) / 1000;
+		sum_us += t;
+		if (t > max_us)
+			max_us = t;
+	}
+
+	transport_mrvl_stop();
+	/* Host end gone, the emulator reads EOF and ends */
+	close(sp[0]);
+	pthread_join(emu.thread, NULL);
+	close(sp[1]);
+
+	if (i < iterations)
+		return -1;
+
+	printf("%-8s %4d resets  %2u cmds/reset  avg %6llu us  max %6llu us\n",
+		label, iterations, emu.cmds / iterations,
+		(unsigned long long) (sum_us / iterations),
+		(unsigned long long) max_us);
+	return (int) (sum_us / iterations);
+}
+
+static int bench_reset(int argc, char **argv)
+{
+	int iterations = argc ? atoi(argv[0]) : RESET_ITERATIONS;
+	int plain, le;
+
+	if (iterations <= 0) {
+		fprintf(stderr, "bad iteration count %s\n", argv[0]);
+		return 1;
+	}
+
+	printf("HCI_Reset round trip, UART modelled at %d baud\n", EMU_BAUD);
+
+	vnd_conf.transport_relay = TRUE;
+	vnd_conf.le_max_tx_octets = 0;
+	vnd_conf.le_max_tx_time = 0;
+	vnd_conf.le_default_phy = 0;
+	plain = bench_reset_run("plain", iterations);
+
+	vnd_conf.le_max_tx_octets = 251;
+	vnd_conf.le_max_tx_time = 2120;
+	vnd_conf.le_default_phy = 0x03;
+	le = bench_reset_run("le", iterations);
+
+	if (plain < 0 || le < 0)
+		return 1;
+
+	printf("LE defaults add %d us per reset\n", le - plain);
+	return 0;
+}
+
+/* One packet from the host end of the port; returns its length */
+static int host_read_pkt(int fd, uint8_t *buf)
+{
+	int hdr, len;
+
+	if (read_full(fd, buf, 1))
+		return -1;
+
+	switch (buf[0]) {
+	case H4_EVT:
+		hdr = 2;
+		break;
+	case H4_SCO:
+		hdr = 3;
+		break;
+	case H4_ACL:
+		hdr = 4;
+		break;
+	default:
+		fprintf(stderr, "host: bad H4 type 0x%02x\n", buf[0]);
+		return -1;
+	}
+
+	if (read_full(fd, buf + 1, hdr))
+		return -1;
+	len = buf[0] == H4_ACL ? buf[3] | (buf[4] << 8) : buf[hdr];
+	if (read_full(fd, buf + 1 + hdr, len))
+		return -1;
+	return 1 + hdr + len;
+}
+
+/*
+ * The lib's vendor commands go out on the port like the stack's own,
+ * and the stack runs one of them at a time.
+ */
+static uint8_t host_xmit(uint16_t opcode, void *p_buf, tINT_CMD_CBACK p_cback)
+{
+	HC_BT_HDR *p_msg = (HC_BT_HDR *) p_buf;
+	uint8_t pkt[1 + 3 + 255];
+
+	if (host.lib_opcode || p_msg->len > sizeof(pkt) - 1) {
+		fprintf(stderr, "lib: cmd 0x%04x refused, 0x%04x in flight\n",
+			opcode, host.lib_opcode);
+		return FALSE;
+	}
+
+	pkt[0] = H4_CMD;
+	memcpy(pkt + 1, (uint8_t *) (p_msg + 1) + p_msg->offset, p_msg->len);
+	if (write_full(host.fd, pkt, 1 + p_msg->len))
+		return FALSE;
+
+	free(p_buf);
+	host.lib_opcode = opcode;
+	host.lib_cb = p_cback;
+	host.lib_cmds++;
+	return TRUE;
+}
+
+/* Hand the Command Complete or Status of the lib's command back to it */
+static int host_lib_evt(const uint8_t *p, int len)
+{
+	tINT_CMD_CBACK p_cback = host.lib_cb;
+	HC_BT_HDR *p_evt;
+	uint16_t opcode;
+
+	if (p[1] == HCI_EVT_CMD_COMPLETE && len >= 6)
+		opcode = p[4] | (p[5] << 8);
+	else if (p[1] == HCI_EVT_CMD_STATUS && len >= 7)
+		opcode = p[5] | (p[6] << 8);
+	else
+		return FALSE;
+
+	if (!host.lib_opcode || opcode != host.lib_opcode)
+		return FALSE;
+
+	p_evt = malloc(sizeof(*p_evt) + len - 1);
+	if (!p_evt)
+		return FALSE;
+	p_evt->event = MSG_HC_TO_STACK_HCI_EVT;
+	p_evt->len = (uint16_t) (len - 1);
+	p_evt->offset = 0;
+	p_evt->layer_specific = 0;
+	memcpy(p_evt + 1, p + 1, len - 1);
+
+	/* The callback may send the next command of its chain */
+	host.lib_opcode = 0;
+	host.lib_cb = NULL;
+	p_cback(p_evt);
+	return TRUE;
+}
+
+static void host_cfg_cb(bt_vendor_op_result_t result)
+{
+	host.cfg_result = result;
+}
+
+static void host_lpm_cb(bt_vendor_op_result_t result)
+{
+	(void) result;
+}
+
+static void *host_alloc(int size)
+{
+	return malloc(size);
+}
+
+static void host_dealloc(void *p_buf)
+{
+	free(p_buf);
+}
+
+static const bt_vendor_callbacks_t host_cbacks = {
+	.size = sizeof(bt_vendor_callbacks_t),
+	.fwcfg_cb = host_cfg_cb,
+	.scocfg_cb = host_cfg_cb,
+	.lpm_cb = host_lpm_cb,
+	.alloc = host_alloc,
+	.dealloc = host_dealloc,
+	.xmit_cb = host_xmit,
+};
+
+static void host_sco_rx(struct bench_sco *b, const uint8_t *p, int len)
+{
+	uint32_t seq, rtt_us, d;
+
+	if (((p[1] | (p[2] << 8)) & 0x0FFF) != b->sco_handle ||
+			len < 4 + (int) sizeof(seq)) {
+		b->stray++;
+		return;
+	}
+
+	memcpy(&seq, p + 4, sizeof(seq));
+	if (seq >= b->sent || !b->sent_ns[seq]) {
+		b->stray++;
+		return;
+	}
+
+	rtt_us = (uint32_t) ((bench_now_ns() - b->sent_ns[seq]) / 1000);
+	b->sent_ns[seq] = 0;
+	b->rcvd++;
+	b->sum_us += rtt_us;
+	if (rtt_us < b->min_us)
+		b->min_us = rtt_us;
+	if (rtt_us > b->max_us)
+		b->max_us = rtt_us;
+	/* Smoothed like RFC 3550 interarrival jitter */
+	if (b->rcvd > 1) {
+		d = rtt_us > b->last_rtt_us ? rtt_us - b->last_rtt_us :
+			b->last_rtt_us - rtt_us;
+		b->jitter_us += ((int32_t) d - (int32_t) b->jitter_us) / 16;
+	}
+	b->last_rtt_us = rtt_us;
+}
+
+/* Every event loopback raises is the host's to handle, like a stack */
+static void host_sco_evt(struct bench_sco *b, const uint8_t *p, int len)
+{
+	uint16_t handle = len >= 6 ? (p[4] | (p[5] << 8)) & 0x0FFF : 0xFFFF;
+
+	switch (p[1]) {
+	case HCI_EVT_CMD_COMPLETE:
+		if (len >= 6 &&
+				(p[4] | (p[5] << 8)) == HCI_WRITE_LOOPBACK_MODE) {
+			b->loopback_cc++;
+			return;
+		}
+		break;
+	case HCI_EVT_CONN_COMPLETE:
+		if (len < 13 || p[3])
+			break;
+		if (p[12] == HCI_LINK_TYPE_SCO)
+			b->sco_handle = handle;
+		b->links++;
+		return;
+	case HCI_EVT_DISCONN_COMPLETE:
+		if (p[3] || !b->links)
+			break;
+		b->links--;
+		return;
+	default:
+		break;
+	}
+	b->stray++;
+}
+
+/* Handle what arrives within timeout_ms; -1 if the port went away */
+static int host_poll(int timeout_ms)
+{
+	uint8_t buf[5 + 0xFFFF];
+	struct pollfd pfd;
+	int len;
+
+	pfd.fd = host.fd;
+	pfd.events = POLLIN;
+	len = poll(&pfd, 1, timeout_ms);
+	if (len <= 0)
+		return len < 0 && errno != EINTR ? -1 : 0;
+
+	len = host_read_pkt(host.fd, buf);
+	if (len < 0)
+		return -1;
+
+	if (buf[0] == H4_SCO)
+		host_sco_rx(&host.sco, buf, len);
+	else if (buf[0] == H4_ACL)
+		host.acl_rcvd++;
+	else if (!host_lib_evt(buf, len))
+		host_sco_evt(&host.sco, buf, len);
+	return 0;
+}
+
+/* Run the port until done() holds; -1 on timeout or a dead port */
+static int host_wait(int (*done)(void))
+{
+	uint64_t deadline = bench_now_ns() + LIB_STEP_MS * 1000000ULL;
+
+	while (!done()) {
+		if (bench_now_ns() >= deadline || host_poll(10) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+static int host_cfg_done(void)
+{
+	return host.cfg_result >= 0;
+}
+
+static int host_lib_idle(void)
+{
+	return !host.lib_opcode;
+}
+
+/* Run a config op the lib answers through fwcfg_cb or scocfg_cb */
+static int host_lib_cfg(bt_vendor_opcode_t opcode)
+{
+	host.cfg_result = -1;
+	BLUETOOTH_VENDOR_LIB_INTERFACE.op(opcode, NULL);
+	if (host_wait(host_cfg_done) ||
+			host.cfg_result != BT_VND_OP_RESULT_SUCCESS)
+		return -1;
+	return 0;
+}
+
+/*
+ * Enable as the stack does, with the node's pty as the mbtchar port:
+ * init, power on, open and FW config. Leaves the lib loaded on failure.
+ */
+static int host_lib_up(const struct bench_node *n, uint8_t sco_path)
+{
+	unsigned char bd_addr[6] = { 0x00, 0x50, 0x43, 0x00, 0x00, 0x01 };
+	int pwr = BT_VND_PWR_ON;
+	int fds[CH_MAX];
+
+	host.lib_opcode = 0;
+	host.lib_cmds = 0;
+	if (BLUETOOTH_VENDOR_LIB_INTERFACE.init(&host_cbacks, bd_addr))
+		return -1;
+
+	/* Init loaded the lib's conf; point it at the emulated node */
+	vnd_conf.transport = MRVL_TRANSPORT_SDIO;
+	snprintf(vnd_conf.mchar_port, sizeof(vnd_conf.mchar_port), "%s",
+		n->path);
+	vnd_conf.sco_data_path = sco_path;
+
+	if (BLUETOOTH_VENDOR_LIB_INTERFACE.op(BT_VND_OP_POWER_CTRL, &pwr))
+		return -1;
+	if (BLUETOOTH_VENDOR_LIB_INTERFACE.op(BT_VND_OP_USERIAL_OPEN,
+			fds) != 1)
+		return -1;
+	host.fd = fds[CH_CMD];
+	return host_lib_cfg(BT_VND_OP_FW_CFG);
+}
+
+static void host_lib_down(void)
+{
+	int pwr = BT_VND_PWR_OFF;
+
+	BLUETOOTH_VENDOR_LIB_INTERFACE.op(BT_VND_OP_USERIAL_CLOSE, NULL);
+	BLUETOOTH_VENDOR_LIB_INTERFACE.op(BT_VND_OP_POWER_CTRL, &pwr);
+	BLUETOOTH_VENDOR_LIB_INTERFACE.cleanup();
+	/* Closed by the lib, along with the relay if there was one */
+	host.fd = -1;
+}
+
+static int node_open(struct bench_node *n)
+{
+	struct termios tio;
+	const char *name;
+
+	memset(n, 0, sizeof(*n));
+	n->slave = -1;
+	n->master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (n->master < 0 || grantpt(n->master) || unlockpt(n->master))
+		goto fail;
+	name = ptsname(n->master);
+	if (!name)
+		goto fail;
+	snprintf(n->path, sizeof(n->path), "%s", name);
+
+	n->slave = open(n->path, O_RDWR | O_NOCTTY);
+	if (n->slave < 0 || tcgetattr(n->slave, &tio))
+		goto fail;
+	cfmakeraw(&tio);
+	if (tcsetattr(n->slave, TCSANOW, &tio))
+		goto fail;
+
+	if (!emu_start(&n->emu, n->master))
+		return 0;
+fail:
+	perror("node pty");
+	if (n->slave >= 0)
+		close(n->slave);
+	if (n->master >= 0)
+		close(n->master);
+	return -1;
+}
+
+static void node_close(struct bench_node *n)
+{
+	n->emu.stop = TRUE;
+	pthread_join(n->emu.thread, NULL);
+	close(n->slave);
+	close(n->master);
+}
+
+/* Switch loopback, then wait for its Command Complete and link events */
+static int host_sco_loopback(struct bench_sco *b, uint8_t mode)
+{
+	uint8_t cmd[5] = { H4_CMD, (uint8_t) HCI_WRITE_LOOPBACK_MODE,
+		(uint8_t) (HCI_WRITE_LOOPBACK_MODE >> 8), 1, mode };
+	int cc = b->loopback_cc + 1;
+	int links = mode ? 2 : 0;
+	uint64_t deadline;
+
+	if (write_full(host.fd, cmd, sizeof(cmd)))
+		return -1;
+
+	deadline = bench_now_ns() + SCO_SETUP_MS * 1000000ULL;
+	while (b->loopback_cc < cc || b->links != links) {
+		if (bench_now_ns() >= deadline || host_poll(10) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * One run: SCO frames paced like a CVSD link through local loopback on
+ * the port the lib handed over. Returns the average round trip in us
+ * and prints a line, -1 on error.
+ */
+static int bench_sco_run(const char *label, uint32_t frames)
+{
+	uint8_t frame[4 + SCO_FRAME_LEN];
+	struct bench_sco *b = &host.sco;
+	uint64_t now, next_ns, deadline;
+	int ret = -1;
+
+	memset(b, 0, sizeof(*b));
+	b->sco_handle = 0xFFFF;
+	b->min_us = 0xFFFFFFFF;
+	b->sent_ns = calloc(frames, sizeof(*b->sent_ns));
+	if (!b->sent_ns)
+		return -1;
+
+	if (host_sco_loopback(b, HCI_LOOPBACK_LOCAL)) {
+		fprintf(stderr, "sco %s: no loopback SCO link\n", label);
+		goto out;
+	}
+
+	memset(frame + 4, 0x55, SCO_FRAME_LEN);
+	frame[0] = H4_SCO;
+	frame[1] = (uint8_t) b->sco_handle;
+	frame[2] = (uint8_t) (b->sco_handle >> 8);
+	frame[3] = SCO_FRAME_LEN;
+
+	next_ns = deadline = bench_now_ns();
+	while (b->rcvd < frames) {
+		now = bench_now_ns();
+		if (b->sent < frames && now >= next_ns) {
+			memcpy(frame + 4, &b->sent, sizeof(b->sent));
+			b->sent_ns[b->sent] = now;
+			if (write_full(host.fd, frame, sizeof(frame)))
+				goto out;
+			b->sent++;
+			next_ns += SCO_FRAME_US * 1000ULL;
+			deadline = now + SCO_SETUP_MS * 1000000ULL;
+			continue;
+		}
+		/* Whatever is still out after the timeout counts as lost */
+		if (b->sent == frames && now >= deadline)
+			break;
+		if (host_poll((int) (((b->sent < frames ? next_ns :
+				deadline) - now + 999999) / 1000000)) < 0)
+			goto out;
+	}
+
+	if (host_sco_loopback(b, HCI_LOOPBACK_OFF)) {
+		fprintf(stderr, "sco %s: loopback links did not go down\n",
+			label);
+		goto out;
+	}
+
+	if (!b->rcvd) {
+		fprintf(stderr, "sco %s: no frame came back\n", label);
+		goto out;
+	}
+
+	ret = (int) (b->sum_us / b->rcvd);
+	printf("%-12s %5u frames  rtt min %5u avg %5d max %5u us  "
+		"jitter %4u us  %u lost  %u stray\n", label, b->sent,
+		b->min_us, ret, b->max_us, b->jitter_us, b->sent - b->rcvd,
+		b->stray);
+
+out:
+	free(b->sent_ns);
+	b->sent_ns = NULL;
+	return ret;
+}
+
+/* SCO over HCI, as the baseline the PCM profiles compare against */
+static int bench_sco_hci(struct bench_node *n, uint32_t frames)
+{
+	int ret = -1;
+
+	if (host_lib_up(n, MRVL_SCO_PATH_HCI) ||
+			host_lib_cfg(BT_VND_OP_SCO_CFG))
+		fprintf(stderr, "sco: lib did not come up for SCO over HCI\n");
+	else
+		ret = bench_sco_run("hci", frames);
+	host_lib_down();
+	return ret;
+}
+
+/*
+ * Every PCM profile in turn on one enabled lib. SCO config sends the
+ * last profile, so each switch after it goes through the PCM update
+ * chain and resends what differs.
+ */
+static int bench_sco_pcm(struct bench_node *n, uint32_t frames)
+{
+	const struct bench_emu *emu = &n->emu;
+	const char *name;
+	unsigned int i, last, cmds;
+	int ret = -1;
+
+	for (last = 0; hw_mrvl_pcm_profile_name(last + 1); last++)
+		;
+
+	if (host_lib_up(n, MRVL_SCO_PATH_PCM) ||
+			BLUETOOTH_VENDOR_LIB_INTERFACE.op(
+				BT_VND_OP_MRVL_SET_PCM_PROFILE,
+				(void *) hw_mrvl_pcm_profile_name(last)) ||
+			host_lib_cfg(BT_VND_OP_SCO_CFG)) {
+		fprintf(stderr, "sco: lib did not come up for SCO over PCM\n");
+		goto out;
+	}
+
+	for (i = 0; (name = hw_mrvl_pcm_profile_name(i)); i++) {
+		cmds = host.lib_cmds;
+		if (BLUETOOTH_VENDOR_LIB_INTERFACE.op(
+				BT_VND_OP_MRVL_SET_PCM_PROFILE,
+				(void *) name) || host_wait(host_lib_idle)) {
+			fprintf(stderr, "sco: PCM profile %s not applied\n",
+				name);
+			goto out;
+		}
+		printf("profile %s: %u cmds, controller %s, slot %u, "
+			"%llu kHz bit clock\n", name, host.lib_cmds - cmds,
+			emu->pcm_role == PCM_ROLE_MASTER ? "master" : "slave",
+			emu->pcm_slot, (unsigned long long)
+			((PCM_BCLK_BASE_HZ << (emu->pcm_clock & 0x07)) / 1000));
+		if (bench_sco_run(name, frames) < 0)
+			goto out;
+		if (emu->pcm_dropped)
+			printf("%-12s %u frames did not fit the slot\n", name,
+				emu->pcm_dropped);
+	}
+	ret = 0;
+
+out:
+	host_lib_down();
+	return ret;
+}
+
+static int bench_sco(int argc, char **argv)
+{
+	int frames = argc ? atoi(argv[0]) : SCO_FRAMES;
+	struct bench_node node;
+	int hci, pcm;
+
+	if (frames <= 0) {
+		fprintf(stderr, "bad frame count %s\n", argv[0]);
+		return 1;
+	}
+
+	printf("SCO local loopback, %d byte frames every %d us, "
+		"UART modelled at %d baud, PCM bus modelled\n", SCO_FRAME_LEN,
+		SCO_FRAME_US, EMU_BAUD);
+
+	if (node_open(&node))
+		return 1;
+	hci = bench_sco_hci(&node, frames);
+	pcm = bench_sco_pcm(&node, frames);
+	node_close(&node);
+
+	return hci < 0 || pcm < 0;
+}
+
+/*
+ * ACL through local loopback, at most NODE_ACL_WINDOW packets in flight
+ * as controller buffers would allow. -1 on a timeout or a dead port.
+ */
+static int host_acl_run(uint32_t pkts)
+{
+	uint8_t pkt[5 + NODE_ACL_LEN];
+	uint64_t deadline;
+	uint32_t sent = 0;
+
+	memset(&host.sco, 0, sizeof(host.sco));
+	host.acl_rcvd = 0;
+	if (host_sco_loopback(&host.sco, HCI_LOOPBACK_LOCAL))
+		return -1;
+
+	memset(pkt + 5, 0xA5, NODE_ACL_LEN);
+	pkt[0] = H4_ACL;
+	pkt[1] = (uint8_t) EMU_ACL_HANDLE;
+	pkt[2] = (uint8_t) (EMU_ACL_HANDLE >> 8);
+	pkt[3] = (uint8_t) NODE_ACL_LEN;
+	pkt[4] = (uint8_t) (NODE_ACL_LEN >> 8);
+
+	deadline = bench_now_ns() + LIB_STEP_MS * 1000000ULL;
+	while (host.acl_rcvd < pkts) {
+		if (sent < pkts && sent - host.acl_rcvd < NODE_ACL_WINDOW) {
+			if (write_full(host.fd, pkt, sizeof(pkt)))
+				return -1;
+			sent++;
+			deadline = bench_now_ns() + LIB_STEP_MS * 1000000ULL;
+			continue;
+		}
+		if (bench_now_ns() >= deadline || host_poll(10) < 0)
+			return -1;
+	}
+
+	return host_sco_loopback(&host.sco, HCI_LOOPBACK_OFF);
+}
+
+/*
+ * One radio, in a process of its own: the lib keeps its state in
+ * process globals, as the stack loads one lib per radio. Sets up its
+ * node, says so on ready_fd, waits for go_fd to close, then enables,
+ * runs traffic and disables. The result goes out on res_fd.
+ */
+static void node_child(int ready_fd, int go_fd, int res_fd)
+{
+	struct node_result r;
+	struct bench_node node;
+	uint64_t t, cpu_us;
+	uint8_t c = 0;
+
+	memset(&r, 0, sizeof(r));
+	if (node_open(&node)) {
+		write_full(ready_fd, &c, 1);
+		write_full(res_fd, (uint8_t *) &r, sizeof(r));
+		_exit(1);
+	}
+
+	write_full(ready_fd, &c, 1);
+	while (read(go_fd, &c, 1) < 0 && errno == EINTR)
+		;
+
+	cpu_us = bench_cpu_us();
+	t = bench_now_ns();
+	if (host_lib_up(&node, MRVL_SCO_PATH_PCM)) {
+		fprintf(stderr, "node %s: enable failed\n", node.path);
+	} else {
+		r.enable_us = (bench_now_ns() - t) / 1000;
+		t = bench_now_ns();
+		if (host_acl_run(NODE_ACL_PKTS)) {
+			fprintf(stderr, "node %s: traffic failed\n", node.path);
+		} else {
+			r.traffic_us = (bench_now_ns() - t) / 1000;
+			r.ok = TRUE;
+		}
+	}
+	r.lib_total_ms = vnd_enable_stats.total_ms;
+	host_lib_down();
+
+	node_close(&node);
+	r.cpu_us = bench_cpu_us() - cpu_us - node.emu.cpu_ns / 1000;
+	write_full(res_fd, (uint8_t *) &r, sizeof(r));
+	_exit(0);
+}
+
+/*
+ * n radios at once, started together once every node is set up.
+ * Prints a line and returns the average enable time in us, -1 when
+ * a node failed.
+ */
+static int bench_nodes_run(int n, int base_enable_us)
+{
+	struct node_result r;
+	uint64_t start, wall_us;
+	uint64_t enable_sum = 0, enable_max = 0, traffic_sum = 0;
+	uint64_t cpu_sum = 0, lib_sum = 0;
+	int ready[2], go[2], res[2];
+	int i, ok = 0, forked;
+	uint8_t c;
+
+	if (pipe(ready) || pipe(go) || pipe(res)) {
+		perror("pipe");
+		return -1;
+	}
+
+	fflush(stdout);
+	for (forked = 0; forked < n; forked++) {
+		pid_t pid = fork();
+
+		if (pid < 0) {
+			perror("fork");
+			break;
+		}
+		if (!pid) {
+			close(ready[0]);
+			close(go[1]);
+			close(res[0]);
+			node_child(ready[1], go[0], res[1]);
+		}
+	}
+	close(ready[1]);
+	close(go[0]);
+	close(res[1]);
+
+	for (i = 0; i < forked; i++)
+		if (read_full(ready[0], &c, 1))
+			break;
+
+	/* Every node up, let them all go */
+	start = bench_now_ns();
+	close(go[1]);
+
+	for (i = 0; i < forked; i++) {
+		if (read_full(res[0], (uint8_t *) &r, sizeof(r)))
+			break;
+		if (!r.ok)
+			continue;
+		ok++;
+		enable_sum += r.enable_us;
+		if (r.enable_us > enable_max)
+			enable_max = r.enable_us;
+		traffic_sum += r.traffic_us;
+		cpu_sum += r.cpu_us;
+		lib_sum += r.lib_total_ms;
+	}
+	wall_us = (bench_now_ns() - start) / 1000;
+
+	close(ready[0]);
+	close(res[0]);
+	while (wait(NULL) > 0 || errno == EINTR)
+		;
+
+	if (!ok) {
+		printf("%5d  no node came up\n", n);
+		return -1;
+	}
+
+	printf("%5d %4d %7llu  %6llu %6llu %5.2fx %6llu  %7llu %8llu\n",
+		n, ok, (unsigned long long) wall_us / 1000,
+		(unsigned long long) enable_sum / ok,
+		(unsigned long long) enable_max,
+		base_enable_us > 0 ? (double) enable_sum / ok /
+			base_enable_us : 1.0,
+		(unsigned long long) lib_sum / ok,
+		(unsigned long long) traffic_sum / ok / 1000,
+		(unsigned long long) cpu_sum / ok);
+	return ok == n ? (int) (enable_sum / ok) : -1;
+}
+
+static int bench_nodes(int argc, char **argv)
+{
+	int max = argc ? atoi(argv[0]) : NODES_MAX;
+	int base = 0, ret = 0, avg;
+	int n;
+
+	if (max <= 0) {
+		fprintf(stderr, "bad node count %s\n", argv[0]);
+		return 1;
+	}
+
+	printf("Nodes enabled at once, each then loops %d ACL packets of %d "
+		"bytes, UART modelled at %d baud\n", NODE_ACL_PKTS,
+		NODE_ACL_LEN, EMU_BAUD);
+	printf("nodes   ok wall ms  enable avg/max us   vs 1  lib ms  "
+		"traffic ms  cpu us/radio\n");
+
+	for (n = 1; ; n = n * 2 < max && n * 2 > n ? n * 2 : max) {
+		avg = bench_nodes_run(n, base);
+		if (avg < 0)
+			ret = 1;
+		else if (n == 1)
+			base = avg;
+		if (n == max)
+			break;
+	}
+	return ret;
+}
+
+/* Emulated controller side: advertising reports paced like a busy scan */
+static void *adv_emitter(void *arg)
+{
+	struct bench_pump *p = arg;
+	/* LE meta, one legacy report, 31 bytes of data, RSSI last */
+	uint8_t rep[3 + 43];
+	static const uint8_t done[] = { H4_EVT, HCI_EVT_NUM_COMPL_PKTS, 1, 0 };
+	struct timespec gap;
+	size_t i;
+
+	memset(rep, 0, sizeof(rep));
+	rep[0] = H4_EVT;
+	rep[1] = HCI_EVT_LE_META;
+	rep[2] = sizeof(rep) - 3;
+	rep[3] = HCI_LE_ADV_REPORT;
+	rep[4] = 1;
+	rep[13] = 31;
+	memset(rep + 14, 0x42, 31);
+
+	gap.tv_sec = 0;
+	gap.tv_nsec = ADV_GAP_US * 16 * 1000L;
+
+	for (i = 0; i < p->total; i++) {
+		rep[7] = (uint8_t) (i % ADV_DEVICES);
+		rep[45] = (uint8_t) -(40 + (int) (i % 20));
+		if (write_full(p->fd, rep, sizeof(rep))) {
+			p->err = errno;
+			return NULL;
+		}
+		if (!(i % 16))
+			nanosleep(&gap, NULL);
+	}
+
+	/* Not an advertising report, so no filter holds it back */
+	if (write_full(p->fd, done, sizeof(done)))
+		p->err = errno;
+	return NULL;
+}
+
+/*
+ * One run: ADV_REPORTS reports through the relay with the given dedup
+ * window, 0 for none. The host side only reads and parses them, far
+ * less than the stack does, so its CPU is a lower bound. Returns the
+ * host CPU in us, -1 on error.
+ */
+static int bench_adv_run(uint32_t window_ms, uint32_t *p_delivered)
+{
+	uint8_t buf[5 + 0xFFFF];
+	struct bench_pump emit;
+	pthread_t th;
+	uint64_t host_ns, cpu_us;
+	uint32_t delivered = 0;
+	int sp[2];
+	int host_fd;
+	int len;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sp) < 0) {
+		perror("socketpair");
+		return -1;
+	}
+
+	vnd_conf.le_adv_dedup_ms = window_ms;
+	host_fd = transport_mrvl_start(sp[0]);
+	if (host_fd < 0) {
+		close(sp[0]);
+		close(sp[1]);
+		return -1;
+	}
+
+	memset(&emit, 0, sizeof(emit));
+	emit.fd = sp[1];
+	emit.total = ADV_REPORTS;
+
+	cpu_us = bench_cpu_us();
+	host_ns = bench_thread_cpu_ns();
+	pthread_create(&th, NULL, adv_emitter, &emit);
+	for (;;) {
+		len = host_read_pkt(host_fd, buf);
+		if (len < 0 || buf[0] != H4_EVT)
+			break;
+		if (buf[1] == HCI_EVT_NUM_COMPL_PKTS)
+			break;
+		if (buf[1] == HCI_EVT_LE_META && buf[3] == HCI_LE_ADV_REPORT &&
+				len > 14 + buf[13])
+			delivered++;
+	}
+	host_ns = bench_thread_cpu_ns() - host_ns;
+	pthread_join(th, NULL);
+	cpu_us = bench_cpu_us() - cpu_us;
+
+	transport_mrvl_stop();
+	close(sp[0]);
+	close(sp[1]);
+
+	if (len < 0 || emit.err) {
+		fprintf(stderr, "adv: transfer failed\n");
+		return -1;
+	}
+
+	printf("window %4u ms  %6u delivered  host %6llu us (%4llu ns each)  "
+		"process %6llu us\n", window_ms, delivered,
+		(unsigned long long) host_ns / 1000,
+		(unsigned long long) (delivered ? host_ns / delivered : 0),
+		(unsigned long long) cpu_us);
+	*p_delivered = delivered;
+	return (int) (host_ns / 1000);
+}
+
+static int bench_adv(int argc, char **argv)
+{
+	int window = argc ? atoi(argv[0]) : ADV_WINDOW_MS;
+	uint32_t all, kept;
+	int off, on;
+
+	if (window <= 0) {
+		fprintf(stderr, "bad dedup window %s\n", argv[0]);
+		return 1;
+	}
+
+	printf("%d reports from %d devices, one every %d us, through the "
+		"relay\n", ADV_REPORTS, ADV_DEVICES, ADV_GAP_US);
+
+	vnd_conf.transport_relay = TRUE;
+	off = bench_adv_run(0, &all);
+	on = bench_adv_run(window, &kept);
+	if (off < 0 || on < 0 || kept >= all)
+		return 1;
+
+	printf("dedup drops %u reports, saves the host %d us, %d ns per "
+		"dropped report\n", all - kept, off - on,
+		(int) ((int64_t) (off - on) * 1000 / (all - kept)));
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s acl [payload sizes...]\n"
+		"       %s reset [iterations]\n"
+		"       %s sco [frames]\n"
+		"       %s adv [dedup window ms]\n"
+		"       %s nodes [max nodes]\n", prog, prog, prog, prog, prog);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	/* Lib defaults, plus the board's settings where there is a file */
+	vnd_load_conf(VENDOR_LIB_CONF_FILE);
+
+	if (!strcmp(argv[1], "acl"))
+		return bench_acl(argc - 2, argv + 2);
+	if (!strcmp(argv[1], "reset"))
+		return bench_reset(argc - 2, argv + 2);
+	if (!strcmp(argv[1], "sco"))
+		return bench_sco(argc - 2, argv + 2);
+	if (!strcmp(argv[1], "adv"))
+		return bench_adv(argc - 2, argv + 2);
+	if (!strcmp(argv[1], "nodes"))
+		return bench_nodes(argc - 2, argv + 2);
+
+	usage(argv[0]);
+	return 1;
+}